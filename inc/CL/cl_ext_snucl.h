@@ -36,6 +36,59 @@ typedef cl_bitfield                      cl_file_open_flags;
 #define CL_COMMAND_COPY_BUFFER_TO_FILE         0x1311
 #define CL_COMMAND_COPY_FILE_TO_BUFFER         0x1312
 
+/* stream-ordered allocation extensions */
+#define CL_COMMAND_ALLOC_BUFFER                0x1313
+#define CL_COMMAND_FREE_BUFFER                 0x1314
+
+/* cl_device_info: device memory statistics */
+#define CL_DEVICE_MEM_EVICTION_COUNT_SNUCL     0x1320
+#define CL_DEVICE_MEM_EVICTED_BYTES_SNUCL      0x1321
+#define CL_DEVICE_MEM_REFAULT_COUNT_SNUCL      0x1322
+#define CL_DEVICE_MEM_FREE_BYTES_SNUCL         0x1323
+#define CL_DEVICE_MEM_LARGEST_FREE_BLOCK_SNUCL 0x1324
+#define CL_DEVICE_MEM_FRAGMENTATION_SNUCL      0x1325
+#define CL_DEVICE_MEM_BANKS_SNUCL              0x1326
+#define CL_DEVICE_READ_CACHE_HIT_COUNT_SNUCL   0x1327
+#define CL_DEVICE_READ_CACHE_MISS_COUNT_SNUCL  0x1328
+#define CL_DEVICE_READ_CACHE_HIT_BYTES_SNUCL   0x1329
+#define CL_DEVICE_WRITE_ELIDED_BYTES_SNUCL     0x132A
+#define CL_DEVICE_WRITE_HASHED_BYTES_SNUCL     0x132B
+#define CL_DEVICE_WRITE_HASH_TIME_SNUCL        0x132C
+#define CL_DEVICE_MEM_COMMITTED_BYTES_SNUCL    0x132D
+#define CL_DEVICE_MEM_RESERVED_BYTES_SNUCL     0x132E
+
+/* cl_device_info: stream-ordered allocation pool */
+#define CL_DEVICE_MEM_POOL_THRESHOLD_SNUCL     0x1340
+#define CL_DEVICE_MEM_POOL_USED_BYTES_SNUCL    0x1341
+#define CL_DEVICE_MEM_POOL_CACHED_BYTES_SNUCL  0x1342
+#define CL_DEVICE_MEM_POOL_ALLOC_COUNT_SNUCL   0x1343
+#define CL_DEVICE_MEM_POOL_REUSE_COUNT_SNUCL   0x1344
+
+/* cl_device_info: device memory compaction */
+#define CL_DEVICE_MEM_COMPACTION_COUNT_SNUCL   0x1345
+#define CL_DEVICE_MEM_COMPACTED_BYTES_SNUCL    0x1346
+#define CL_DEVICE_MEM_COMPACTION_GAIN_SNUCL    0x1347
+
+/* cl_device_info: host memory registration */
+#define CL_DEVICE_PINNED_HOST_BYTES_SNUCL      0x1348
+#define CL_DEVICE_PIN_CACHE_HIT_COUNT_SNUCL    0x1349
+#define CL_DEVICE_PIN_CACHE_MISS_COUNT_SNUCL   0x134A
+#define CL_DEVICE_PIN_CACHE_BYTES_SNUCL        0x134B
+
+/* cl_device_info: unaligned write merging */
+#define CL_DEVICE_LINE_CACHE_HIT_COUNT_SNUCL   0x134C
+#define CL_DEVICE_LINE_CACHE_MISS_COUNT_SNUCL  0x134D
+
+/* cl_mem_flags: memory bank placement */
+#define CL_MEM_BANK_SELECT_SNUCL(bank)         ((cl_mem_flags)((bank) + 1) << 16)
+#define CL_MEM_BANK_SELECT_MASK_SNUCL          ((cl_mem_flags)7 << 16)
+#define CL_MEM_BANK_AUTO_SNUCL                 ((cl_mem_flags)1 << 19)
+#define CL_MEM_BANK_INTERLEAVED_SNUCL          ((cl_mem_flags)1 << 20)
+
+/* cl_mem_info */
+#define CL_MEM_BANK_SNUCL                      0x1330
+#define CL_MEM_RESERVED_SIZE_SNUCL             0x1331
+
 /* Collective Communication APIs */
 extern CL_API_ENTRY cl_int CL_API_CALL
 clEnqueueAlltoAllBuffer(cl_command_queue * cmd_queue_list,
@@ -195,6 +248,48 @@ clGetFileHandlerInfo(cl_file file,
                      void * param_value,
                      size_t * param_value_size_ret);
 
+extern CL_API_ENTRY cl_mem CL_API_CALL
+clCreateGrowableBuffer(cl_context context,
+                       cl_mem_flags flags,
+                       size_t size, // committed size
+                       size_t max_size, // reserved size
+                       cl_int * errcode_ret);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clGrowBuffer(cl_mem buffer,
+             size_t size);
+
+/* Stream-Ordered Allocation APIs */
+extern CL_API_ENTRY cl_mem CL_API_CALL
+clEnqueueAllocBuffer(cl_command_queue command_queue,
+                     cl_mem_flags flags,
+                     size_t size,
+                     cl_uint num_events_in_wait_list,
+                     const cl_event * event_wait_list,
+                     cl_event * event,
+                     cl_int * errcode_ret);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clEnqueueFreeBuffer(cl_command_queue command_queue,
+                    cl_mem buffer,
+                    cl_uint num_events_in_wait_list,
+                    const cl_event * event_wait_list,
+                    cl_event * event);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clSetMemPoolThreshold(cl_device_id device,
+                      size_t threshold);
+
+/* Host Memory Registration APIs */
+extern CL_API_ENTRY cl_int CL_API_CALL
+clRegisterHostMemory(cl_context context,
+                     void * ptr,
+                     size_t size);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clUnregisterHostMemory(cl_context context,
+                       void * ptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,8 @@
 
 #include "CLAPI.h"
 #include <cstring>
+#include <vector>
+#include <unistd.h>
 #include <CL/cl.h>
 #include <CL/cl_ext_snucl.h>
 #include "Callbacks.h"
@@ -53,6 +55,7 @@
 #include "CLFile.h"
 #include "CLKernel.h"
 #include "CLMem.h"
+#include "CLMemPool.h"
 #include "CLObject.h"
 #include "CLPlatform.h"
 #include "CLProgram.h"
@@ -172,6 +175,27 @@ static bool IS_INVALID_MEM_FLAGS(cl_mem_flags flags) {
       (host_no_access && host_write_only) ||
       (host_read_only && host_write_only))
     return true;
+  cl_mem_flags bank_select = (flags & CL_MEM_BANK_SELECT_MASK_SNUCL);
+  cl_mem_flags bank_auto = (flags & CL_MEM_BANK_AUTO_SNUCL);
+  cl_mem_flags bank_interleaved = (flags & CL_MEM_BANK_INTERLEAVED_SNUCL);
+  if ((bank_select && bank_auto) || (bank_select && bank_interleaved) ||
+      (bank_auto && bank_interleaved))
+    return true;
+  return false;
+}
+
+// A selected bank must exist on every device that may hold the buffer
+static bool IS_INVALID_MEM_BANK(const vector<CLDevice*>& devices,
+                                cl_mem_flags flags) {
+  if (!(flags & CL_MEM_BANK_SELECT_MASK_SNUCL))
+    return false;
+  int bank = (int)((flags & CL_MEM_BANK_SELECT_MASK_SNUCL) >> 16) - 1;
+  for (vector<CLDevice*>::const_iterator it = devices.begin();
+       it != devices.end();
+       ++it) {
+    if (bank >= (*it)->GetNumMemBanks())
+      return true;
+  }
   return false;
 }
 
@@ -531,7 +555,8 @@ SNUCL_API_FUNCTION(clCreateBuffer)(
     cl_int* errcode_ret) CL_API_SUFFIX__VERSION_1_0 {
   if (IS_INVALID_CONTEXT(context))
     SET_ERROR_AND_RETURN(CL_INVALID_CONTEXT, NULL);
-  if (IS_INVALID_MEM_FLAGS(flags))
+  if (IS_INVALID_MEM_FLAGS(flags) ||
+      IS_INVALID_MEM_BANK(context->c_obj->devices(), flags))
     SET_ERROR_AND_RETURN(CL_INVALID_VALUE, NULL);
   if (size == 0)
     SET_ERROR_AND_RETURN(CL_INVALID_BUFFER_SIZE, NULL);
@@ -1233,7 +1258,7 @@ SNUCL_API_FUNCTION(clFinish)(cl_command_queue command_queue)
   CLCommand* command = CLCommand::CreateMarker(NULL, NULL, q);
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
-  CLEvent* blocking = command->ExportEvent();
+  CLEvent* blocking = command->ExportEventToUser();
   q->Enqueue(command);
   blocking->Wait();
   blocking->Release();
@@ -1275,10 +1300,10 @@ SNUCL_API_FUNCTION(clEnqueueReadBuffer)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_read == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_read == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_read == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1339,10 +1364,10 @@ SNUCL_API_FUNCTION(clEnqueueReadBufferRect)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_read == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_read == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_read == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1387,10 +1412,10 @@ SNUCL_API_FUNCTION(clEnqueueWriteBuffer)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_write == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_write == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_write == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1451,10 +1476,10 @@ SNUCL_API_FUNCTION(clEnqueueWriteBufferRect)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_write == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_write == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_write == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1504,7 +1529,7 @@ SNUCL_API_FUNCTION(clEnqueueFillBuffer)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1548,7 +1573,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyBuffer)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1587,7 +1612,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyBufferRect)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1626,10 +1651,10 @@ SNUCL_API_FUNCTION(clEnqueueReadImage)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_read == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_read == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_read == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1674,10 +1699,10 @@ SNUCL_API_FUNCTION(clEnqueueWriteImage)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_write == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_write == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_write == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1717,7 +1742,7 @@ SNUCL_API_FUNCTION(clEnqueueFillImage)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1753,7 +1778,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyImage)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1789,7 +1814,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyImageToBuffer)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1825,7 +1850,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyBufferToImage)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -1885,7 +1910,7 @@ SNUCL_API_FUNCTION(clEnqueueMapBuffer)(
     return NULL;
   }
 
-  void* mapped_ptr = b->MapAsBuffer(map_flags, offset, size);
+  void* mapped_ptr = b->MapAsBuffer(q->device(), map_flags, offset, size);
   if (mapped_ptr == NULL) {
     if (errcode_ret) *errcode_ret = CL_OUT_OF_HOST_MEMORY;
     return NULL;
@@ -1899,10 +1924,10 @@ SNUCL_API_FUNCTION(clEnqueueMapBuffer)(
   }
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_map == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_map == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_map == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -1987,10 +2012,10 @@ SNUCL_API_FUNCTION(clEnqueueMapImage)(
   }
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_map == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_map == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_map == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -2034,7 +2059,7 @@ SNUCL_API_FUNCTION(clEnqueueUnmapMemObject)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2050,6 +2075,9 @@ SNUCL_API_FUNCTION(clEnqueueMigrateMemObjects)(
     return CL_INVALID_COMMAND_QUEUE;
   if (num_mem_objects == 0 || mem_objects == NULL)
     return CL_INVALID_VALUE;
+  if (flags & ~(CL_MIGRATE_MEM_OBJECT_HOST |
+                CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED))
+    return CL_INVALID_VALUE;
   if ((num_events_in_wait_list > 0 && event_wait_list == NULL) ||
       (num_events_in_wait_list == 0 && event_wait_list != NULL))
     return CL_INVALID_EVENT_WAIT_LIST;
@@ -2073,10 +2101,10 @@ SNUCL_API_FUNCTION(clEnqueueMigrateMemObjects)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
-  return CL_INVALID_VALUE;
+  return CL_SUCCESS;
 }
 
 CL_API_ENTRY cl_int CL_API_CALL
@@ -2126,7 +2154,7 @@ SNUCL_API_FUNCTION(clEnqueueNDRangeKernel)(
    if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2185,7 +2213,7 @@ SNUCL_API_FUNCTION(clEnqueueNativeKernel)(
    if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2204,7 +2232,7 @@ SNUCL_API_FUNCTION(clEnqueueMarkerWithWaitList)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2223,7 +2251,7 @@ SNUCL_API_FUNCTION(clEnqueueBarrierWithWaitList)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2295,7 +2323,7 @@ SNUCL_API_FUNCTION(clEnqueueMarker)(
   CLCommand* command = CLCommand::CreateMarker(NULL, NULL, q);
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
-  *event = command->ExportEvent()->st_obj();
+  *event = command->ExportEventToUser()->st_obj();
   q->Enqueue(command);
   return CL_SUCCESS;
 }
@@ -2355,7 +2383,7 @@ SNUCL_API_FUNCTION(clEnqueueAlltoAllBuffer)(
     if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
     command->SetWaitList(num_events_in_wait_list, event_wait_list);
-    if (event_list) event_list[i] = command->ExportEvent()->st_obj();
+    if (event_list) event_list[i] = command->ExportEventToUser()->st_obj();
   }
   return CL_SUCCESS;
 }
@@ -2377,7 +2405,7 @@ SNUCL_API_FUNCTION(clEnqueueBroadcastBuffer)(
     if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
     command->SetWaitList(num_events_in_wait_list, event_wait_list);
-    if (event_list) event_list[i] = command->ExportEvent()->st_obj();
+    if (event_list) event_list[i] = command->ExportEventToUser()->st_obj();
   }
   return CL_SUCCESS;
 }
@@ -2400,7 +2428,7 @@ SNUCL_API_FUNCTION(clEnqueueScatterBuffer)(
     if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
     command->SetWaitList(num_events_in_wait_list, event_wait_list);
-    if (event_list) event_list[i] = command->ExportEvent()->st_obj();
+    if (event_list) event_list[i] = command->ExportEventToUser()->st_obj();
   }
   return CL_SUCCESS;
 }
@@ -2424,7 +2452,7 @@ SNUCL_API_FUNCTION(clEnqueueGatherBuffer)(
     if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
     command->SetWaitList(num_events_in_wait_list, event_wait_list);
-    if (event_list) event_list[i] = command->ExportEvent()->st_obj();
+    if (event_list) event_list[i] = command->ExportEventToUser()->st_obj();
   }
   return CL_SUCCESS;
 }
@@ -2852,10 +2880,10 @@ SNUCL_API_FUNCTION(clEnqueueLocalFileOpen)(
   }
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   CLEvent* blocking;
-  if (blocking_open == CL_TRUE) blocking = command->ExportEvent();
+  if (blocking_open == CL_TRUE) blocking = command->ExportEventToUser();
   q->Enqueue(command);
   if (blocking_open == CL_TRUE) {
     cl_int ret = blocking->Wait();
@@ -2906,7 +2934,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyBufferToFile)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2948,7 +2976,7 @@ SNUCL_API_FUNCTION(clEnqueueCopyFileToBuffer)(
   if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
 
   command->SetWaitList(num_events_in_wait_list, event_wait_list);
-  if (event) *event = command->ExportEvent()->st_obj();
+  if (event) *event = command->ExportEventToUser()->st_obj();
 
   q->Enqueue(command);
   return CL_SUCCESS;
@@ -2963,6 +2991,174 @@ SNUCL_API_FUNCTION(clReleaseFile)(cl_file file) {
   return CL_SUCCESS;
 }
 
+CL_API_ENTRY cl_mem CL_API_CALL
+SNUCL_API_FUNCTION(clCreateGrowableBuffer)(
+    cl_context context, cl_mem_flags flags, size_t size, size_t max_size,
+    cl_int* errcode_ret) {
+  if (IS_INVALID_CONTEXT(context))
+    SET_ERROR_AND_RETURN(CL_INVALID_CONTEXT, NULL);
+  if (IS_INVALID_MEM_FLAGS(flags) ||
+      IS_INVALID_MEM_BANK(context->c_obj->devices(), flags))
+    SET_ERROR_AND_RETURN(CL_INVALID_VALUE, NULL);
+  // The host memory could not grow along with the buffer
+  if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR |
+               CL_MEM_COPY_HOST_PTR))
+    SET_ERROR_AND_RETURN(CL_INVALID_VALUE, NULL);
+  if (size == 0 || max_size < size)
+    SET_ERROR_AND_RETURN(CL_INVALID_BUFFER_SIZE, NULL);
+
+  cl_int err = CL_SUCCESS;
+  CLMem* mem = CLMem::CreateGrowableBuffer(context->c_obj, flags, size,
+                                           max_size, &err);
+  if (err != CL_SUCCESS)
+    SET_ERROR_AND_RETURN(err, NULL);
+  SET_ERROR_AND_RETURN(CL_SUCCESS, mem->st_obj());
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clGrowBuffer)(cl_mem buffer, size_t size) {
+  if (IS_INVALID_MEM_OBJECT(buffer))
+    return CL_INVALID_MEM_OBJECT;
+
+  return buffer->c_obj->Grow(size);
+}
+
+CL_API_ENTRY cl_mem CL_API_CALL
+SNUCL_API_FUNCTION(clEnqueueAllocBuffer)(
+    cl_command_queue command_queue, cl_mem_flags flags, size_t size,
+    cl_uint num_events_in_wait_list, const cl_event* event_wait_list,
+    cl_event* event, cl_int* errcode_ret) {
+  if (IS_INVALID_COMMAND_QUEUE(command_queue))
+    SET_ERROR_AND_RETURN(CL_INVALID_COMMAND_QUEUE, NULL);
+  if (IS_INVALID_MEM_FLAGS(flags) ||
+      IS_INVALID_MEM_BANK(
+          command_queue->c_obj->context()->devices(), flags))
+    SET_ERROR_AND_RETURN(CL_INVALID_VALUE, NULL);
+  // Pooled buffers are reused, so they cannot be tied to host memory
+  if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR |
+               CL_MEM_COPY_HOST_PTR))
+    SET_ERROR_AND_RETURN(CL_INVALID_VALUE, NULL);
+  if (size == 0)
+    SET_ERROR_AND_RETURN(CL_INVALID_BUFFER_SIZE, NULL);
+  if ((num_events_in_wait_list > 0 && event_wait_list == NULL) ||
+      (num_events_in_wait_list == 0 && event_wait_list != NULL))
+    SET_ERROR_AND_RETURN(CL_INVALID_EVENT_WAIT_LIST, NULL);
+
+  CLCommandQueue* q = command_queue->c_obj;
+  for (cl_uint i = 0; i < num_events_in_wait_list; i++) {
+    if (!event_wait_list[i])
+      SET_ERROR_AND_RETURN(CL_INVALID_EVENT_WAIT_LIST, NULL);
+    if (q->context() != event_wait_list[i]->c_obj->context())
+      SET_ERROR_AND_RETURN(CL_INVALID_CONTEXT, NULL);
+  }
+
+  cl_int err = CL_SUCCESS;
+  CLMem* mem = q->device()->mem_pool()->Alloc(q, flags, size, &err);
+  if (err != CL_SUCCESS)
+    SET_ERROR_AND_RETURN(err, NULL);
+
+  CLCommand* command = CLCommand::CreateAllocBuffer(NULL, NULL, q, mem);
+  if (command == NULL) {
+    mem->Release();
+    SET_ERROR_AND_RETURN(CL_OUT_OF_HOST_MEMORY, NULL);
+  }
+
+  command->SetWaitList(num_events_in_wait_list, event_wait_list);
+  if (event) *event = command->ExportEventToUser()->st_obj();
+
+  q->Enqueue(command);
+  SET_ERROR_AND_RETURN(CL_SUCCESS, mem->st_obj());
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clEnqueueFreeBuffer)(
+    cl_command_queue command_queue, cl_mem buffer,
+    cl_uint num_events_in_wait_list, const cl_event* event_wait_list,
+    cl_event* event) {
+  if (IS_INVALID_COMMAND_QUEUE(command_queue))
+    return CL_INVALID_COMMAND_QUEUE;
+  if (IS_INVALID_MEM_OBJECT(buffer))
+    return CL_INVALID_MEM_OBJECT;
+  if ((num_events_in_wait_list > 0 && event_wait_list == NULL) ||
+      (num_events_in_wait_list == 0 && event_wait_list != NULL))
+    return CL_INVALID_EVENT_WAIT_LIST;
+
+  CLCommandQueue* q = command_queue->c_obj;
+  CLMem* b = buffer->c_obj;
+  if (q->context() != b->context())
+    return CL_INVALID_CONTEXT;
+  for (cl_uint i = 0; i < num_events_in_wait_list; i++) {
+    if (!event_wait_list[i])
+      return CL_INVALID_EVENT_WAIT_LIST;
+    if (q->context() != event_wait_list[i]->c_obj->context())
+      return CL_INVALID_CONTEXT;
+  }
+
+  CLMemPool* pool = q->device()->mem_pool();
+  if (!pool->IsAllocated(b))
+    return CL_INVALID_MEM_OBJECT;
+
+  CLCommand* command = CLCommand::CreateFreeBuffer(NULL, NULL, q, b);
+  if (command == NULL) return CL_OUT_OF_HOST_MEMORY;
+
+  command->SetWaitList(num_events_in_wait_list, event_wait_list);
+  if (event) *event = command->ExportEventToUser()->st_obj();
+
+  // The pool may hand out the buffer again once the free is done. The free
+  // is enqueued first so that an allocation on the same queue that takes
+  // the buffer is ordered after it.
+  CLEvent* free_event = command->ExportEvent();
+  q->Enqueue(command);
+  pool->Free(q, b, free_event);
+  free_event->Release();
+  return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clSetMemPoolThreshold)(cl_device_id device,
+                                          size_t threshold) {
+  if (IS_INVALID_DEVICE(device))
+    return CL_INVALID_DEVICE;
+
+  device->c_obj->mem_pool()->SetThreshold(threshold);
+  return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clRegisterHostMemory)(cl_context context, void* ptr,
+                                         size_t size) {
+  if (IS_INVALID_CONTEXT(context))
+    return CL_INVALID_CONTEXT;
+  // Only whole pages can be pinned
+  size_t page_size = (size_t)getpagesize();
+  if (ptr == NULL || size == 0 || (size_t)ptr % page_size != 0 ||
+      size % page_size != 0)
+    return CL_INVALID_VALUE;
+
+  const vector<CLDevice*>& devices = context->c_obj->devices();
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (!devices[i]->RegisterHostMem(ptr, size)) {
+      // Overlaps a registered range
+      for (size_t j = 0; j < i; j++)
+        devices[j]->UnregisterHostMem(ptr);
+      return CL_INVALID_VALUE;
+    }
+  }
+  return CL_SUCCESS;
+}
+
+CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clUnregisterHostMemory)(cl_context context, void* ptr) {
+  if (IS_INVALID_CONTEXT(context))
+    return CL_INVALID_CONTEXT;
+
+  const vector<CLDevice*>& devices = context->c_obj->devices();
+  bool found = false;
+  for (size_t i = 0; i < devices.size(); i++)
+    found |= devices[i]->UnregisterHostMem(ptr);
+  return (found ? CL_SUCCESS : CL_INVALID_VALUE);
+}
+
 CL_API_ENTRY cl_int CL_API_CALL
 SNUCL_API_FUNCTION(clIcdGetPlatformIDsKHR)(
     cl_uint num_entries, cl_platform_id* platforms, cl_uint* num_platforms) {
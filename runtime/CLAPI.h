@@ -690,6 +690,40 @@ SNUCL_API_FUNCTION(clGetFileHandlerInfo)(
     cl_file file, cl_file_info param_name, size_t param_value_size,
     void* param_value, size_t* param_value_size_ret);
 
+/* SnuCL Extension - Growable Buffer APIs */
+extern CL_API_ENTRY cl_mem CL_API_CALL
+SNUCL_API_FUNCTION(clCreateGrowableBuffer)(
+    cl_context context, cl_mem_flags flags, size_t size, size_t max_size,
+    cl_int* errcode_ret);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clGrowBuffer)(cl_mem buffer, size_t size);
+
+/* SnuCL Extension - Stream-Ordered Allocation APIs */
+extern CL_API_ENTRY cl_mem CL_API_CALL
+SNUCL_API_FUNCTION(clEnqueueAllocBuffer)(
+    cl_command_queue command_queue, cl_mem_flags flags, size_t size,
+    cl_uint num_events_in_wait_list, const cl_event* event_wait_list,
+    cl_event* event, cl_int* errcode_ret);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clEnqueueFreeBuffer)(
+    cl_command_queue command_queue, cl_mem buffer,
+    cl_uint num_events_in_wait_list, const cl_event* event_wait_list,
+    cl_event* event);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clSetMemPoolThreshold)(cl_device_id device,
+                                          size_t threshold);
+
+/* SnuCL Extension - Host Memory Registration APIs */
+extern CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clRegisterHostMemory)(cl_context context, void* ptr,
+                                         size_t size);
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+SNUCL_API_FUNCTION(clUnregisterHostMemory)(cl_context context, void* ptr);
+
 extern CL_API_ENTRY cl_int CL_API_CALL
 SNUCL_API_FUNCTION(clIcdGetPlatformIDsKHR)(
     cl_uint num_entries, cl_platform_id* platforms, cl_uint* num_platforms);
@@ -61,6 +61,11 @@
 
 using namespace std;
 
+// Granularity at which a replicated range is read and written in a pipeline
+#define REPLICATION_CHUNK_SIZE ((size_t)4 << 20)
+// Chunks of a replicated range staged in host memory at once
+#define REPLICATION_NUM_SLOTS 4
+
 CLCommand::CLCommand(CLContext* context, CLDevice* device,
                      CLCommandQueue* queue, cl_command_type type) {
   type_ = type;
@@ -81,6 +86,11 @@ CLCommand::CLCommand(CLContext* context, CLDevice* device,
   wait_events_complete_ = false;
   wait_events_good_ = true;
   consistency_resolved_ = false;
+  mems_in_use_ = false;
+  read_from_host_ = false;
+  event_exported_ = false;
+  dead_write_ = false;
+  fill_host_cache_ = false;
   error_ = CL_SUCCESS;
 
   dev_src_ = NULL;
@@ -110,6 +120,7 @@ CLCommand::CLCommand(CLContext* context, CLDevice* device,
 }
 
 CLCommand::~CLCommand() {
+  EndUseOfMems();
   if (queue_) queue_->Release();
   context_->Release();
   for (vector<CLEvent*>::iterator it = wait_events_.begin();
@@ -197,6 +208,7 @@ bool CLCommand::IsExecutable() {
 }
 
 void CLCommand::Submit() {
+  BeginUseOfMems();
   event_->SetStatus(CL_SUBMITTED);
   device_->EnqueueReadyQueue(this);
 }
@@ -222,6 +234,70 @@ CLEvent* CLCommand::ExportEvent() {
   return event_;
 }
 
+CLEvent* CLCommand::ExportEventToUser() {
+  event_exported_ = true;
+  return ExportEvent();
+}
+
+static CLMem* GetRootMem(CLMem* mem) {
+  return (mem->parent() != NULL ? mem->parent() : mem);
+}
+
+// Returns the range of the root buffer that the command overwrites without
+// reading it
+bool CLCommand::GetWrittenRange(CLMem** root, size_t* offset,
+                                size_t* size) const {
+  switch (type_) {
+    case CL_COMMAND_WRITE_BUFFER:
+    case CL_COMMAND_FILL_BUFFER:
+      break;
+    case CL_COMMAND_COPY_BUFFER:
+      if (GetRootMem(mem_src_) == GetRootMem(mem_dst_))
+        return false;
+      break;
+    case CL_COMMAND_FREE_BUFFER:
+      // Nothing may read a freed buffer
+      break;
+    default:
+      return false;
+  }
+  *root = GetRootMem(mem_dst_);
+  *offset = mem_dst_->offset() + off_dst_;
+  *size = size_;
+  return true;
+}
+
+bool CLCommand::AccessesMem(CLMem* root) const {
+  switch (type_) {
+    case CL_COMMAND_MARKER:
+    case CL_COMMAND_BARRIER:
+    case CL_COMMAND_NOP:
+      return false;
+    case CL_COMMAND_CUSTOM:
+      return true;
+    default:
+      break;
+  }
+  if (mem_src_ != NULL && GetRootMem(mem_src_) == root)
+    return true;
+  if (mem_dst_ != NULL && GetRootMem(mem_dst_) == root)
+    return true;
+  if (kernel_args_ != NULL) {
+    for (map<cl_uint, CLKernelArg*>::const_iterator it = kernel_args_->begin();
+         it != kernel_args_->end();
+         ++it) {
+      CLMem* mem = it->second->mem;
+      if (mem != NULL && GetRootMem(mem) == root)
+        return true;
+    }
+  }
+  for (cl_uint i = 0; mem_list_ != NULL && i < num_mem_objects_; i++) {
+    if (GetRootMem(mem_list_[i]) == root)
+      return true;
+  }
+  return false;
+}
+
 void CLCommand::AnnotateSourceDevice(CLDevice* device) {
   dev_src_ = device;
 }
@@ -258,10 +334,17 @@ void CLCommand::Execute() {
                                   num_mem_objects_, mem_list_, mem_offsets_);
       break;
     case CL_COMMAND_READ_BUFFER:
-      device_->ReadBuffer(this, mem_src_, off_src_, size_, ptr_);
+      if (read_from_host_) {
+        memcpy(ptr_, (char*)mem_src_->GetHostPtr() + off_src_, size_);
+      } else {
+        device_->ReadBuffer(this, mem_src_, off_src_, size_, ptr_);
+        if (fill_host_cache_)
+          memcpy((char*)mem_src_->GetHostPtr() + off_src_, ptr_, size_);
+      }
       break;
     case CL_COMMAND_WRITE_BUFFER:
-      device_->WriteBuffer(this, mem_dst_, off_dst_, size_, ptr_);
+      if (!dead_write_)
+        device_->WriteBuffer(this, mem_dst_, off_dst_, size_, ptr_);
       break;
     case CL_COMMAND_COPY_BUFFER:
       device_->CopyBuffer(this, mem_src_, mem_dst_, off_src_, off_dst_, size_);
@@ -315,14 +398,16 @@ void CLCommand::Execute() {
                               dst_slice_pitch_);
       break;
     case CL_COMMAND_BARRIER:
+      device_->CompactMem();
       break;
     case CL_COMMAND_MIGRATE_MEM_OBJECTS:
       device_->MigrateMemObjects(this, num_mem_objects_, mem_list_,
                                  migration_flags_);
       break;
     case CL_COMMAND_FILL_BUFFER:
-      device_->FillBuffer(this, mem_dst_, pattern_, pattern_size_, off_dst_,
-                          size_);
+      if (!dead_write_)
+        device_->FillBuffer(this, mem_dst_, pattern_, pattern_size_, off_dst_,
+                            size_);
       break;
     case CL_COMMAND_FILL_IMAGE:
       device_->FillImage(this, mem_dst_, ptr_, dst_origin_, region_);
@@ -363,6 +448,11 @@ void CLCommand::Execute() {
       device_->CopyFileToBuffer(this, file_src_, mem_dst_, off_src_, off_dst_,
                                 size_);
       break;
+    case CL_COMMAND_ALLOC_BUFFER:
+      mem_dst_->GetDevSpecific(device_);
+      break;
+    case CL_COMMAND_FREE_BUFFER:
+      break;
     default:
       SNUCL_ERROR("Unsupported command [%x]", type_);
       break;
@@ -370,8 +460,10 @@ void CLCommand::Execute() {
 }
 
 bool CLCommand::ResolveConsistency() {
+  BeginUseOfMems();
   bool resolved = consistency_resolved_;
   if (!resolved) {
+    SyncHostWritesOfMems();
     switch (type_) {
       case CL_COMMAND_NDRANGE_KERNEL:
       case CL_COMMAND_TASK:
@@ -418,6 +510,9 @@ bool CLCommand::ResolveConsistency() {
       case CL_COMMAND_COPY_FILE_TO_BUFFER:
         resolved = ResolveConsistencyOfCopyFileToMem();
         break;
+      case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+        resolved = ResolveConsistencyOfMigrate();
+        break;
       default:
         resolved = true;
         break;
@@ -470,6 +565,13 @@ bool CLCommand::ResolveConsistency() {
       case CL_COMMAND_COPY_FILE_TO_BUFFER:
         UpdateConsistencyOfCopyFileToMem();
         break;
+      case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+        UpdateConsistencyOfMigrate();
+        break;
+      case CL_COMMAND_ALLOC_BUFFER:
+        // A pooled buffer starts without contents
+        mem_dst_->DiscardContents();
+        break;
       default:
         break;
     }
@@ -499,7 +601,27 @@ bool CLCommand::ResolveConsistencyOfLaunchNativeKernel() {
 }
 
 bool CLCommand::ResolveConsistencyOfReadMem() {
-  bool already_resolved = ChangeDeviceToReadMem(mem_src_, device_);
+  if (type_ != CL_COMMAND_READ_BUFFER) {
+    bool already_resolved = ChangeDeviceToReadMem(mem_src_, device_);
+    consistency_resolved_ = true;
+    return already_resolved;
+  }
+
+  CLDevice* device = device_;
+  bool already_resolved;
+  if (!mem_src_->EmptyLatest() &&
+      mem_src_->HasLatest(LATEST_HOST, off_src_, size_)) {
+    // The host shadow is up to date, so no transfer is needed
+    mem_src_->AllocHostPtr();
+    mem_src_->TouchHostCache();
+    read_from_host_ = true;
+    already_resolved = !WaitForPendingTransfer(mem_src_, LATEST_HOST, off_src_,
+                                               size_);
+  } else {
+    already_resolved = ChangeDeviceToReadMem(mem_src_, device_);
+    fill_host_cache_ = mem_src_->AcquireHostCache();
+  }
+  device->CountReadCacheAccess(read_from_host_, size_);
   consistency_resolved_ = true;
   return already_resolved;
 }
@@ -507,9 +629,17 @@ bool CLCommand::ResolveConsistencyOfReadMem() {
 bool CLCommand::ResolveConsistencyOfWriteMem() {
   bool already_resolved = true;
   bool write_all = false;
+  bool write_range = false;
   switch (type_) {
     case CL_COMMAND_WRITE_BUFFER:
-      write_all = (off_dst_ == 0 && size_ == mem_dst_->size());
+    case CL_COMMAND_FILL_BUFFER:
+      // Only the written range becomes the latest in the device
+      write_range = true;
+      if (queue_ != NULL && queue_->IsOverwritten(this)) {
+        dead_write_ = true;
+        consistency_resolved_ = true;
+        return true;
+      }
       break;
     case CL_COMMAND_WRITE_IMAGE: {
       size_t* region = mem_dst_->GetImageRegion();
@@ -526,7 +656,6 @@ bool CLCommand::ResolveConsistencyOfWriteMem() {
                    (dst_slice_pitch_ == 0 ||
                     dst_slice_pitch_ == region_[0] * region_[1]));
       break;
-    case CL_COMMAND_FILL_BUFFER:
     case CL_COMMAND_FILL_IMAGE:
       write_all = true;
       break;
@@ -534,7 +663,10 @@ bool CLCommand::ResolveConsistencyOfWriteMem() {
       SNUCL_ERROR("Unsupported command [%x]", type_);
       break;
   }
-  if (!write_all)
+  if (write_range)
+    already_resolved &= !WaitForPendingTransfer(mem_dst_, device_, off_dst_,
+                                                size_);
+  else if (!write_all)
     already_resolved &= LocateMemOnDevice(mem_dst_);
   consistency_resolved_ = true;
   return already_resolved;
@@ -547,13 +679,11 @@ bool CLCommand::ResolveConsistencyOfCopyMem() {
 
   bool already_resolved = true;
   bool write_all = false;
+  bool write_range = false;
   switch (type_) {
     case CL_COMMAND_COPY_BUFFER:
-      write_all = (off_dst_ == 0 && size_ == mem_dst_->size());
-      break;
     case CL_COMMAND_COPY_IMAGE_TO_BUFFER:
-      write_all = (off_dst_ == 0 &&
-                   region_[0] * region_[1] * region_[2] == mem_dst_->size());
+      write_range = true;
       break;
     case CL_COMMAND_COPY_IMAGE:
     case CL_COMMAND_COPY_BUFFER_TO_IMAGE: {
@@ -575,7 +705,10 @@ bool CLCommand::ResolveConsistencyOfCopyMem() {
       SNUCL_ERROR("Unsupported command [%x]", type_);
       break;
   }
-  if (!write_all)
+  if (write_range)
+    already_resolved &= !WaitForPendingTransfer(mem_dst_, device_, off_dst_,
+                                                GetDstRangeSize());
+  else if (!write_all)
     already_resolved &= LocateMemOnDevice(mem_dst_);
 
   bool use_read, use_write, use_copy, use_send, use_recv, use_rcopy;
@@ -700,13 +833,25 @@ bool CLCommand::ResolveConsistencyOfCopyMem() {
 }
 
 bool CLCommand::ResolveConsistencyOfMap() {
-  bool already_resolved = LocateMemOnDevice(mem_src_);
+  bool already_resolved = true;
+  // The old contents are never read if the whole object is invalidated
+  if ((map_flags_ & (CL_MAP_READ | CL_MAP_WRITE)) ||
+      !mem_src_->IsMapWritebackAll(ptr_)) {
+    // A USE_HOST_PTR buffer is mapped to its host memory
+    if (mem_src_->IsBuffer() && mem_src_->IsUseHostPtr())
+      already_resolved = LocateMemOnHost(mem_src_);
+    else
+      already_resolved = LocateMemOnDevice(mem_src_);
+  }
   consistency_resolved_ = true;
   return already_resolved;
 }
 
 bool CLCommand::ResolveConsistencyOfUnmap() {
-  bool already_resolved = LocateMemOnDevice(mem_src_);
+  bool already_resolved = true;
+  if (!mem_src_->IsMapWritebackAll(ptr_) &&
+      !(mem_src_->IsBuffer() && mem_src_->IsUseHostPtr()))
+    already_resolved = LocateMemOnDevice(mem_src_);
   consistency_resolved_ = true;
   return already_resolved;
 }
@@ -744,13 +889,31 @@ bool CLCommand::ResolveConsistencyOfCopyFileToMem() {
   return already_resolved;
 }
 
+bool CLCommand::ResolveConsistencyOfMigrate() {
+  bool already_resolved = true;
+  // Old contents need not be moved if they are going to be overwritten
+  if (!(migration_flags_ & CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED)) {
+    for (cl_uint i = 0; i < num_mem_objects_; i++) {
+      if (migration_flags_ & CL_MIGRATE_MEM_OBJECT_HOST)
+        already_resolved &= LocateMemOnHost(mem_list_[i]);
+      else
+        already_resolved &= LocateMemOnDevice(mem_list_[i]);
+    }
+  }
+  consistency_resolved_ = true;
+  return already_resolved;
+}
+
 void CLCommand::UpdateConsistencyOfLaunchKernel() {
   for (map<cl_uint, CLKernelArg*>::iterator it = kernel_args_->begin();
        it != kernel_args_->end();
        ++it) {
     CLKernelArg* arg = it->second;
-    if (arg->mem != NULL)
-      AccessMemOnDevice(arg->mem, arg->mem->IsWritable());
+    if (arg->mem == NULL)
+      continue;
+    // Read-only arguments keep the other valid replicas
+    bool write = arg->mem->IsWritable() && !kernel_->IsArgReadOnly(it->first);
+    AccessMemOnDevice(arg->mem, write);
   }
 }
 
@@ -760,22 +923,45 @@ void CLCommand::UpdateConsistencyOfLaunchNativeKernel() {
 }
 
 void CLCommand::UpdateConsistencyOfReadMem() {
+  if (read_from_host_)
+    return;
   AccessMemOnDevice(mem_src_, false);
+  if (fill_host_cache_) {
+    mem_src_->SetPendingEvent(LATEST_HOST, off_src_, size_, event_);
+    mem_src_->AddLatest(LATEST_HOST, off_src_, size_);
+  }
 }
 
 void CLCommand::UpdateConsistencyOfWriteMem() {
-  AccessMemOnDevice(mem_dst_, true);
+  if (dead_write_)
+    return;
+  if (type_ == CL_COMMAND_WRITE_BUFFER || type_ == CL_COMMAND_FILL_BUFFER)
+    mem_dst_->SetLatest(device_, off_dst_, size_);
+  else
+    AccessMemOnDevice(mem_dst_, true);
 }
 
 void CLCommand::UpdateConsistencyOfCopyMem() {
-  AccessMemOnDevice(mem_dst_, true);
+  if (type_ == CL_COMMAND_COPY_BUFFER ||
+      type_ == CL_COMMAND_COPY_IMAGE_TO_BUFFER)
+    mem_dst_->SetLatest(device_, off_dst_, GetDstRangeSize());
+  else
+    AccessMemOnDevice(mem_dst_, true);
 }
 
 void CLCommand::UpdateConsistencyOfMap() {
+  if (mem_src_->IsBuffer() && mem_src_->IsUseHostPtr())
+    return;
   AccessMemOnDevice(mem_src_, false);
 }
 
 void CLCommand::UpdateConsistencyOfUnmap() {
+  if (mem_src_->IsBuffer() && mem_src_->IsUseHostPtr()) {
+    size_t offset, size;
+    if (mem_src_->PeekMapWritebackLayoutForBuffer(ptr_, &offset, &size))
+      mem_src_->MarkHostWritten(offset, size);
+    return;
+  }
   AccessMemOnDevice(mem_src_, true);
 }
 
@@ -795,6 +981,28 @@ void CLCommand::UpdateConsistencyOfCopyFileToMem() {
   AccessMemOnDevice(mem_dst_, true);
 }
 
+void CLCommand::UpdateConsistencyOfMigrate() {
+  for (cl_uint i = 0; i < num_mem_objects_; i++) {
+    CLMem* mem = mem_list_[i];
+    if (migration_flags_ & CL_MIGRATE_MEM_OBJECT_HOST) {
+      if (migration_flags_ & CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED) {
+        mem->AllocHostPtr();
+        mem->SetLatest(LATEST_HOST);
+      }
+    } else {
+      AccessMemOnDevice(mem, (migration_flags_ &
+                              CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED) != 0);
+    }
+  }
+}
+
+// Bytes written to the destination buffer by a copy command
+size_t CLCommand::GetDstRangeSize() {
+  if (type_ == CL_COMMAND_COPY_IMAGE_TO_BUFFER)
+    return mem_src_->GetRegionSize(region_);
+  return size_;
+}
+
 void CLCommand::GetCopyPattern(CLDevice* dev_src, CLDevice* dev_dst,
                                bool& use_read, bool& use_write, bool& use_copy,
                                bool& use_send, bool& use_recv, bool& use_rcopy,
@@ -808,6 +1016,7 @@ void CLCommand::GetCopyPattern(CLDevice* dev_src, CLDevice* dev_dst,
    * (3) dev_src -> Read -> a temporary buffer in host -> Write -> dev_dst
    * (4) dev_src -> ClusterDriver -> dev_dst
    * (5) dev_src -> Read -> MPI_Send -> MPI_Recv -> Write -> dev_dst
+   * (6) dev_src -> Read -> host pointer (dev_dst == LATEST_HOST)
    *
    * No.  Required Commands                     Intermediate Buffer
    *      read  write  copy  send  recv  rcopy  alloc  use_host
@@ -816,6 +1025,7 @@ void CLCommand::GetCopyPattern(CLDevice* dev_src, CLDevice* dev_dst,
    * (3)  TRUE  TRUE                            TRUE
    * (4)                                 TRUE
    * (5)                     TRUE  TRUE
+   * (6)  TRUE                                          TRUE
    */
 
   use_read = false;
@@ -829,6 +1039,9 @@ void CLCommand::GetCopyPattern(CLDevice* dev_src, CLDevice* dev_dst,
 
   if (dev_src == dev_dst) { // (1)
     use_copy = true;
+  } else if (dev_dst == LATEST_HOST) { // (6)
+    use_read = true;
+    use_host_ptr = true;
   } else if (dev_src == LATEST_HOST) { // (2)
     use_write = true;
     use_host_ptr = true;
@@ -852,18 +1065,48 @@ static void CL_CALLBACK IssueCommandCallback(cl_event event, cl_int status,
   command->Submit();
 }
 
+typedef struct _CLDeferredIssue {
+  CLCommand* command;
+  vector<CLEvent*> events; // retained
+} CLDeferredIssue;
+
+// Submits the command after all the events complete, one at a time
+static void CL_CALLBACK IssueDeferredCallback(cl_event event, cl_int status,
+                                              void* user_data) {
+  CLDeferredIssue* issue = (CLDeferredIssue*)user_data;
+  if (!issue->events.empty()) {
+    CLEvent* next = issue->events.back();
+    issue->events.pop_back();
+    next->AddCallback(new EventCallback(IssueDeferredCallback, issue,
+                                        CL_COMPLETE));
+    next->Release();
+    return;
+  }
+  issue->command->Submit();
+  delete issue;
+}
+
 CLEvent* CLCommand::CloneMem(CLDevice* dev_src, CLDevice* dev_dst,
-                             CLMem* mem) {
+                             CLMem* mem, size_t offset, size_t size) {
   bool use_read, use_write, use_copy, use_send, use_recv, use_rcopy;
   bool alloc_ptr, use_host_ptr;
   GetCopyPattern(dev_src, dev_dst, use_read, use_write, use_copy, use_send,
                  use_recv, use_rcopy, alloc_ptr, use_host_ptr);
 
+  // Images are always cloned as a whole
+  if (mem->IsImage()) {
+    offset = 0;
+    size = mem->size();
+  }
+
   void* ptr = NULL;
   if (alloc_ptr)
-    ptr = memalign(4096, mem->size());
-  if (use_host_ptr)
-    ptr = mem->GetHostPtr();
+    ptr = memalign(4096, size);
+  if (use_host_ptr) {
+    // A sub-buffer may not have seen the host pointer of its parent yet
+    mem->AllocHostPtr();
+    ptr = (void*)((size_t)mem->GetHostPtr() + offset);
+  }
 
   CLCommand* read = NULL;
   CLCommand* write = NULL;
@@ -882,14 +1125,13 @@ CLEvent* CLCommand::CloneMem(CLDevice* dev_src, CLDevice* dev_dst,
                              region);
   } else {
     if (use_read || use_send)
-      read = CreateReadBuffer(context_, dev_src, NULL, mem, 0, mem->size(),
-                              ptr);
+      read = CreateReadBuffer(context_, dev_src, NULL, mem, offset, size, ptr);
     if (use_write || use_recv)
-      write = CreateWriteBuffer(context_, dev_dst, NULL, mem, 0, mem->size(),
+      write = CreateWriteBuffer(context_, dev_dst, NULL, mem, offset, size,
                                 ptr);
     if (use_copy || use_rcopy)
-      copy = CreateCopyBuffer(context_, dev_dst, NULL, mem, mem, 0, 0,
-                              mem->size());
+      copy = CreateCopyBuffer(context_, dev_dst, NULL, mem, mem, offset,
+                              offset, size);
   }
   if (use_send) {
     read->AnnotateDestinationNode(dev_dst->node_id());
@@ -907,33 +1149,186 @@ CLEvent* CLCommand::CloneMem(CLDevice* dev_src, CLDevice* dev_dst,
   CLEvent* last_event = NULL;
   if (copy != NULL)
     last_event = copy->ExportEvent();
-  else
+  else if (write != NULL)
     last_event = write->ExportEvent();
+  else
+    last_event = read->ExportEvent();
 
   if (use_read && use_write) {
     read->event_->AddCallback(new EventCallback(IssueCommandCallback, write,
                                                 CL_COMPLETE));
     write = NULL;
   }
-  if (read != NULL)
-    read->Submit();
-  if (write != NULL)
+
+  // The copy in dev_dst is the latest one but cannot be used until the
+  // transfer completes
+  mem->SetPendingEvent(dev_dst, offset, size, last_event);
+  mem->AddLatest(dev_dst, offset, size);
+
+  // The source itself may still be receiving the range
+  CLCommand* first = (read != NULL ? read : (write != NULL ? write : copy));
+  CLDeferredIssue* issue = new CLDeferredIssue;
+  issue->command = first;
+  mem->GetPendingEvents(dev_src, offset, size, issue->events);
+  if (!issue->events.empty())
+    first->BeginUseOfMems();
+  IssueDeferredCallback(NULL, CL_COMPLETE, issue);
+  if (write != NULL && write != first)
     write->Submit();
-  if (copy != NULL)
+  if (copy != NULL && copy != first)
     copy->Submit();
-  mem->AddLatest(dev_dst);
 
   return last_event;
 }
 
-bool CLCommand::LocateMemOnDevice(CLMem* mem) {
-  if (mem->HasLatest(device_) || mem->EmptyLatest())
+typedef struct _CLReplicaStaging {
+  void* ptr;
+  int refs; // writes that have not completed yet
+} CLReplicaStaging;
+
+static void CL_CALLBACK ReleaseStagingCallback(cl_event event, cl_int status,
+                                               void* user_data) {
+  CLReplicaStaging* staging = (CLReplicaStaging*)user_data;
+  if (__sync_sub_and_fetch(&staging->refs, 1) == 0) {
+    free(staging->ptr);
+    delete staging;
+  }
+}
+
+// Collects the devices whose stale replicas of a read-only buffer are brought
+// up to date together with dev_dst. The other devices must not be using it.
+void CLCommand::GetReplicaDevices(CLDevice* dev_src, CLDevice* dev_dst,
+                                  CLMem* mem, size_t offset, size_t size,
+                                  vector<CLDevice*>& dev_dsts) {
+  dev_dsts.push_back(dev_dst);
+  if (dev_src == LATEST_HOST || dev_src == dev_dst ||
+      dev_src->node_id() != 0 || dev_dst->node_id() != 0 ||
+      !mem->IsBuffer() || mem->IsWritable() || mem->IsUsedByOthers())
+    return;
+  const vector<CLDevice*>& devices = context_->devices();
+  for (vector<CLDevice*>::const_iterator it = devices.begin();
+       it != devices.end();
+       ++it) {
+    CLDevice* device = *it;
+    if (device != dev_src && device != dev_dst && device->node_id() == 0 &&
+        mem->HasDevSpecific(device) && !mem->HasLatest(device, offset, size))
+      dev_dsts.push_back(device);
+  }
+}
+
+// Reads each chunk of the range from dev_src once into a staging slot and
+// writes it to all the destinations as soon as it arrives. A slot is read
+// into again once every write of its previous chunk has completed. Returns
+// the retained event of the last write to each destination, or false if no
+// staging memory is available.
+bool CLCommand::ReplicateMem(CLDevice* dev_src, vector<CLDevice*>& dev_dsts,
+                             CLMem* mem, size_t offset, size_t size,
+                             vector<CLEvent*>& last_events) {
+  size_t num_chunks = (size + REPLICATION_CHUNK_SIZE - 1) /
+                      REPLICATION_CHUNK_SIZE;
+  size_t num_slots = min(num_chunks, (size_t)REPLICATION_NUM_SLOTS);
+  void* ptr = memalign(4096, num_slots * REPLICATION_CHUNK_SIZE);
+  if (ptr == NULL) {
+    SNUCL_ERROR("Cannot allocate 0x%zX bytes for replication",
+                num_slots * REPLICATION_CHUNK_SIZE);
+    return false;
+  }
+  CLReplicaStaging* staging = new CLReplicaStaging;
+  staging->ptr = ptr;
+  staging->refs = num_chunks * dev_dsts.size();
+  last_events.assign(dev_dsts.size(), NULL);
+  vector<vector<CLEvent*> > slot_events(num_slots); // retained
+
+  for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+    size_t chunk_offset = offset + chunk * REPLICATION_CHUNK_SIZE;
+    size_t chunk_size = min(REPLICATION_CHUNK_SIZE,
+                            offset + size - chunk_offset);
+    size_t slot = chunk % num_slots;
+    void* slot_ptr = (void*)((size_t)ptr + slot * REPLICATION_CHUNK_SIZE);
+    CLCommand* read = CreateReadBuffer(context_, dev_src, NULL, mem,
+                                       chunk_offset, chunk_size, slot_ptr);
+    CLDeferredIssue* issue = new CLDeferredIssue;
+    issue->command = read;
+    issue->events.swap(slot_events[slot]);
+    for (size_t i = 0; i < dev_dsts.size(); i++) {
+      CLCommand* write = CreateWriteBuffer(context_, dev_dsts[i], NULL, mem,
+                                           chunk_offset, chunk_size,
+                                           slot_ptr);
+      write->event_->AddCallback(new EventCallback(ReleaseStagingCallback,
+                                                   staging, CL_COMPLETE));
+      CLEvent* event = write->ExportEvent();
+      mem->SetPendingEvent(dev_dsts[i], chunk_offset, chunk_size, event);
+      if (last_events[i] != NULL)
+        last_events[i]->Release();
+      last_events[i] = event;
+      event->Retain();
+      slot_events[slot].push_back(event);
+      read->event_->AddCallback(new EventCallback(IssueCommandCallback, write,
+                                                  CL_COMPLETE));
+    }
+
+    mem->GetPendingEvents(dev_src, chunk_offset, chunk_size, issue->events);
+    if (!issue->events.empty())
+      read->BeginUseOfMems();
+    IssueDeferredCallback(NULL, CL_COMPLETE, issue);
+  }
+  for (size_t slot = 0; slot < num_slots; slot++) {
+    for (size_t i = 0; i < slot_events[slot].size(); i++)
+      slot_events[slot][i]->Release();
+  }
+
+  // All the destinations become latest at once
+  mem->AddLatest(dev_dsts, offset, size);
+  return true;
+}
+
+bool CLCommand::WaitForPendingTransfer(CLMem* mem, CLDevice* device,
+                                       size_t offset, size_t size) {
+  vector<CLEvent*> events;
+  mem->GetPendingEvents(device, offset, size, events);
+  for (vector<CLEvent*>::iterator it = events.begin();
+       it != events.end();
+       ++it) {
+    AddWaitEvent(*it);
+    (*it)->Release();
+  }
+  return !events.empty();
+}
+
+// Clones only the ranges of the memory object that are stale in the device
+bool CLCommand::LocateMem(CLMem* mem, CLDevice* device) {
+  if (mem->EmptyLatest())
     return true;
-  CLDevice* source = mem->GetNearestLatest(device_);
-  CLEvent* last_event = CloneMem(source, device_, mem);
-  AddWaitEvent(last_event);
-  last_event->Release();
-  return false;
+  bool already_resolved = !WaitForPendingTransfer(mem, device, 0,
+                                                  mem->size());
+  vector<CLMemRange> ranges;
+  mem->GetMissingRanges(device, ranges);
+  for (vector<CLMemRange>::iterator it = ranges.begin();
+       it != ranges.end();
+       ++it) {
+    vector<CLDevice*> dev_dsts;
+    GetReplicaDevices(it->source, device, mem, it->offset, it->size,
+                      dev_dsts);
+    vector<CLEvent*> last_events;
+    if (dev_dsts.size() > 1 &&
+        ReplicateMem(it->source, dev_dsts, mem, it->offset, it->size,
+                     last_events)) {
+      AddWaitEvent(last_events[0]);
+      for (size_t i = 0; i < last_events.size(); i++)
+        last_events[i]->Release();
+    } else {
+      CLEvent* last_event = CloneMem(it->source, device, mem, it->offset,
+                                     it->size);
+      AddWaitEvent(last_event);
+      last_event->Release();
+    }
+    already_resolved = false;
+  }
+  return already_resolved;
+}
+
+bool CLCommand::LocateMemOnDevice(CLMem* mem) {
+  return LocateMem(mem, device_);
 }
 
 void CLCommand::AccessMemOnDevice(CLMem* mem, bool write) {
@@ -943,18 +1338,79 @@ void CLCommand::AccessMemOnDevice(CLMem* mem, bool write) {
     mem->AddLatest(device_);
 }
 
+bool CLCommand::LocateMemOnHost(CLMem* mem) {
+  return LocateMem(mem, LATEST_HOST);
+}
+
 bool CLCommand::ChangeDeviceToReadMem(CLMem* mem, CLDevice*& device) {
-  if (mem->HasLatest(device) || mem->EmptyLatest())
+  if (mem->EmptyLatest())
     return true;
-  CLDevice* source = mem->GetNearestLatest(device);
-  if (source == LATEST_HOST) {
-    CLEvent* last_event = CloneMem(source, device, mem);
-    AddWaitEvent(last_event);
-    last_event->Release();
-    return false;
+  vector<CLMemRange> ranges;
+  mem->GetMissingRanges(device, ranges);
+  if (!ranges.empty()) {
+    // Read from another device only if it has the whole object
+    CLDevice* source = ranges.front().source;
+    if (source == LATEST_HOST || !mem->HasLatest(source))
+      return LocateMem(mem, device);
+    device = source;
+  }
+  return !WaitForPendingTransfer(mem, device, 0, mem->size());
+}
+
+void CLCommand::BeginUseOfMems() {
+  if (mems_in_use_)
+    return;
+  if (mem_src_) mem_src_->BeginUse();
+  if (mem_dst_) mem_dst_->BeginUse();
+  if (kernel_args_) {
+    for (map<cl_uint, CLKernelArg*>::iterator it = kernel_args_->begin();
+         it != kernel_args_->end();
+         ++it) {
+      if (it->second->mem) it->second->mem->BeginUse();
+    }
+  }
+  if (mem_list_) {
+    for (cl_uint i = 0; i < num_mem_objects_; i++)
+      mem_list_[i]->BeginUse();
+  }
+  mems_in_use_ = true;
+}
+
+void CLCommand::EndUseOfMems() {
+  if (!mems_in_use_)
+    return;
+  if (mem_src_) mem_src_->EndUse();
+  if (mem_dst_) mem_dst_->EndUse();
+  if (kernel_args_) {
+    for (map<cl_uint, CLKernelArg*>::iterator it = kernel_args_->begin();
+         it != kernel_args_->end();
+         ++it) {
+      if (it->second->mem) it->second->mem->EndUse();
+    }
+  }
+  if (mem_list_) {
+    for (cl_uint i = 0; i < num_mem_objects_; i++)
+      mem_list_[i]->EndUse();
+  }
+  mems_in_use_ = false;
+}
+
+// Marks the pages the application has written since the last command as
+// host-latest before the command decides what to transfer
+void CLCommand::SyncHostWritesOfMems() {
+  if (mem_src_) mem_src_->SyncHostWrites();
+  if (mem_dst_) mem_dst_->SyncHostWrites();
+  if (kernel_args_) {
+    for (map<cl_uint, CLKernelArg*>::iterator it = kernel_args_->begin();
+         it != kernel_args_->end();
+         ++it) {
+      if (it->second->mem) it->second->mem->SyncHostWrites();
+    }
+  }
+  if (mem_list_) {
+    for (cl_uint i = 0; i < num_mem_objects_; i++)
+      mem_list_[i]->SyncHostWrites();
   }
-  device = source;
-  return true;
 }
 
 CLCommand*
@@ -1269,6 +1725,7 @@ CLCommand::CreateMigrateMemObjects(CLContext* context, CLDevice* device,
     command->mem_list_[i]->Retain();
   }
   command->migration_flags_ = flags;
+  return command;
 }
 
 CLCommand*
@@ -1516,3 +1973,29 @@ CLCommand::CreateCopyFileToBuffer(CLContext* context, CLDevice* device,
   command->size_ = size;
   return command;
 }
+
+CLCommand*
+CLCommand::CreateAllocBuffer(CLContext* context, CLDevice* device,
+                             CLCommandQueue* queue, CLMem* buffer) {
+  CLCommand* command = new CLCommand(context, device, queue,
+                                     CL_COMMAND_ALLOC_BUFFER);
+  if (command == NULL) return NULL;
+  command->mem_dst_ = buffer;
+  command->mem_dst_->Retain();
+  command->off_dst_ = 0;
+  command->size_ = buffer->size();
+  return command;
+}
+
+CLCommand*
+CLCommand::CreateFreeBuffer(CLContext* context, CLDevice* device,
+                            CLCommandQueue* queue, CLMem* buffer) {
+  CLCommand* command = new CLCommand(context, device, queue,
+                                     CL_COMMAND_FREE_BUFFER);
+  if (command == NULL) return NULL;
+  command->mem_dst_ = buffer;
+  command->mem_dst_->Retain();
+  command->off_dst_ = 0;
+  command->size_ = buffer->size();
+  return command;
+}
@@ -93,6 +93,12 @@ class CLCommand {
   void SetAsComplete();
 
   CLEvent* ExportEvent();
+  CLEvent* ExportEventToUser();
+  bool IsEventExported() const { return event_exported_; }
+
+  // Used to find writes that are overwritten before anything reads them
+  bool GetWrittenRange(CLMem** root, size_t* offset, size_t* size) const;
+  bool AccessesMem(CLMem* root) const;
 
   /* Extra annotations for commands
    * 
@@ -132,6 +138,7 @@ class CLCommand {
   bool ResolveConsistencyOfAlltoAll();
   bool ResolveConsistencyOfCopyMemToFile();
   bool ResolveConsistencyOfCopyFileToMem();
+  bool ResolveConsistencyOfMigrate();
 
   void UpdateConsistencyOfLaunchKernel();
   void UpdateConsistencyOfLaunchNativeKernel();
@@ -144,16 +151,32 @@ class CLCommand {
   void UpdateConsistencyOfAlltoAll();
   void UpdateConsistencyOfCopyMemToFile();
   void UpdateConsistencyOfCopyFileToMem();
+  void UpdateConsistencyOfMigrate();
 
   void GetCopyPattern(CLDevice* dev_src, CLDevice* dev_dst, bool& use_read,
                       bool& use_write, bool& use_copy, bool& use_send,
                       bool& use_recv, bool& use_rcopy, bool& alloc_ptr,
                       bool& use_host_ptr);
-  CLEvent* CloneMem(CLDevice* dev_src, CLDevice* dev_dst, CLMem* mem);
-
+  size_t GetDstRangeSize();
+  CLEvent* CloneMem(CLDevice* dev_src, CLDevice* dev_dst, CLMem* mem,
+                    size_t offset, size_t size);
+  void GetReplicaDevices(CLDevice* dev_src, CLDevice* dev_dst, CLMem* mem,
+                         size_t offset, size_t size,
+                         std::vector<CLDevice*>& dev_dsts);
+  bool ReplicateMem(CLDevice* dev_src, std::vector<CLDevice*>& dev_dsts,
+                    CLMem* mem, size_t offset, size_t size,
+                    std::vector<CLEvent*>& last_events);
+
+  bool WaitForPendingTransfer(CLMem* mem, CLDevice* device, size_t offset,
+                              size_t size);
+  bool LocateMem(CLMem* mem, CLDevice* device);
   bool LocateMemOnDevice(CLMem* mem);
+  bool LocateMemOnHost(CLMem* mem);
   void AccessMemOnDevice(CLMem* mem, bool write);
   bool ChangeDeviceToReadMem(CLMem* mem, CLDevice*& device);
+  void BeginUseOfMems();
+  void EndUseOfMems();
+  void SyncHostWritesOfMems();
 
   cl_command_type type_;
   CLCommandQueue* queue_;
@@ -164,6 +187,11 @@ class CLCommand {
   bool wait_events_complete_;
   bool wait_events_good_;
   bool consistency_resolved_;
+  bool mems_in_use_;
+  bool read_from_host_; // served from the host shadow without a transfer
+  bool event_exported_; // the application holds the event
+  bool dead_write_; // completes without a transfer
+  bool fill_host_cache_; // also keeps the read contents in the host shadow
   cl_int error_;
 
   CLDevice* dev_src_;
@@ -392,6 +420,14 @@ class CLCommand {
                          CLCommandQueue* queue, CLFile* src_file,
                          CLMem* dst_buffer, size_t src_offset,
                          size_t dst_offset, size_t size);
+
+  static CLCommand*
+  CreateAllocBuffer(CLContext* context, CLDevice* device,
+                    CLCommandQueue* queue, CLMem* buffer);
+
+  static CLCommand*
+  CreateFreeBuffer(CLContext* context, CLDevice* device,
+                   CLCommandQueue* queue, CLMem* buffer);
 };
 
 #endif // __SNUCL__CL_COMMAND_H
@@ -54,6 +54,7 @@
 using namespace std;
 
 #define COMMAND_QUEUE_SIZE 4096
+#define DEAD_WRITE_WINDOW  64
 
 CLCommandQueue::CLCommandQueue(CLContext *context, CLDevice* device,
                                cl_command_queue_properties properties) {
@@ -147,6 +148,33 @@ void CLInOrderCommandQueue::Dequeue(CLCommand* command) {
 #endif // SNUCL_DEBUG
 }
 
+// Returns true if the write at the head of the queue is completely overwritten
+// by a later command before anything can observe it
+bool CLInOrderCommandQueue::IsOverwritten(CLCommand* command) {
+  CLMem* root;
+  size_t offset, size;
+  if (command->IsEventExported() ||
+      !command->GetWrittenRange(&root, &offset, &size))
+    return false;
+
+  for (unsigned long i = 1; i < DEAD_WRITE_WINDOW; i++) {
+    CLCommand* next;
+    if (!queue_.PeekAt(i, &next))
+      break;
+    CLMem* next_root;
+    size_t next_offset, next_size;
+    if (next->GetWrittenRange(&next_root, &next_offset, &next_size) &&
+        next_root == root && next_offset <= offset &&
+        offset + size <= next_offset + next_size)
+      return true;
+    // The application may wait for the command and then read the buffer
+    // through another queue
+    if (next->IsEventExported() || next->AccessesMem(root))
+      return false;
+  }
+  return false;
+}
+
 CLOutOfOrderCommandQueue::CLOutOfOrderCommandQueue(
     CLContext* context, CLDevice* device,
     cl_command_queue_properties properties)
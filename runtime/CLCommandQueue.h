@@ -74,10 +74,14 @@ class CLCommandQueue: public CLObject<struct _cl_command_queue,
   bool IsProfiled() const {
     return (properties_ & CL_QUEUE_PROFILING_ENABLE);
   }
+  bool IsInOrder() const {
+    return !(properties_ & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+  }
 
   virtual CLCommand* Peek() = 0;
   virtual void Enqueue(CLCommand* command) = 0;
   virtual void Dequeue(CLCommand* command) = 0;
+  virtual bool IsOverwritten(CLCommand* command) { return false; }
   void Flush() {}
 
  protected:
@@ -103,6 +107,7 @@ class CLInOrderCommandQueue: public CLCommandQueue {
   virtual CLCommand* Peek();
   virtual void Enqueue(CLCommand* command);
   virtual void Dequeue(CLCommand* command);
+  virtual bool IsOverwritten(CLCommand* command);
 
  private:
   LockFreeQueueMS queue_;
@@ -51,6 +51,7 @@
 #include "CLEvent.h"
 #include "CLKernel.h"
 #include "CLMem.h"
+#include "CLMemPool.h"
 #include "CLObject.h"
 #include "CLPlatform.h"
 #include "CLProgram.h"
@@ -63,7 +64,7 @@ using namespace std;
 #define READY_QUEUE_SIZE 4096
 
 CLDevice::CLDevice(int node_id)
-    : ready_queue_(READY_QUEUE_SIZE) {
+    : ready_queue_(READY_QUEUE_SIZE), copy_queue_(READY_QUEUE_SIZE) {
   CLPlatform* platform = CLPlatform::GetPlatform();
   platform->AddDevice(this);
   scheduler_ = platform->AllocIdleScheduler();
@@ -71,10 +72,16 @@ CLDevice::CLDevice(int node_id)
   parent_ = NULL;
 
   sem_init(&sem_ready_queue_, 0, 0);
+  copy_lane_enabled_ = false;
+  read_cache_hits_ = 0;
+  read_cache_misses_ = 0;
+  read_cache_hit_bytes_ = 0;
+  sem_init(&sem_copy_queue_, 0, 0);
+  mem_pool_ = new CLMemPool();
 }
 
 CLDevice::CLDevice(CLDevice* parent)
-    : ready_queue_(READY_QUEUE_SIZE) {
+    : ready_queue_(READY_QUEUE_SIZE), copy_queue_(READY_QUEUE_SIZE) {
   CLPlatform* platform = CLPlatform::GetPlatform();
   platform->AddDevice(this);
   scheduler_ = parent->scheduler_;
@@ -82,6 +89,12 @@ CLDevice::CLDevice(CLDevice* parent)
   parent_ = parent;
 
   sem_init(&sem_ready_queue_, 0, 0);
+  copy_lane_enabled_ = false;
+  read_cache_hits_ = 0;
+  read_cache_misses_ = 0;
+  read_cache_hit_bytes_ = 0;
+  sem_init(&sem_copy_queue_, 0, 0);
+  mem_pool_ = new CLMemPool();
 
   /*
    * OpenCL 1.2 Specification rev 19
@@ -197,7 +210,9 @@ void CLDevice::Cleanup() {
 }
 
 CLDevice::~CLDevice() {
+  delete mem_pool_;
   sem_destroy(&sem_ready_queue_);
+  sem_destroy(&sem_copy_queue_);
 }
 
 cl_int CLDevice::GetDeviceInfo(cl_device_info param_name,
@@ -348,11 +363,45 @@ cl_int CLDevice::GetDeviceInfo(cl_device_info param_name,
 
     GET_OBJECT_INFO_T(CL_DEVICE_REFERENCE_COUNT, cl_uint, ref_cnt());
 
-    default: return CL_INVALID_VALUE;
+    GET_OBJECT_INFO(CL_DEVICE_READ_CACHE_HIT_COUNT_SNUCL, cl_ulong,
+                    read_cache_hits_);
+    GET_OBJECT_INFO(CL_DEVICE_READ_CACHE_MISS_COUNT_SNUCL, cl_ulong,
+                    read_cache_misses_);
+    GET_OBJECT_INFO(CL_DEVICE_READ_CACHE_HIT_BYTES_SNUCL, cl_ulong,
+                    read_cache_hit_bytes_);
+    GET_OBJECT_INFO_T(CL_DEVICE_MEM_POOL_THRESHOLD_SNUCL, size_t,
+                      mem_pool_->threshold());
+    GET_OBJECT_INFO_T(CL_DEVICE_MEM_POOL_USED_BYTES_SNUCL, size_t,
+                      mem_pool_->used_bytes());
+    GET_OBJECT_INFO_T(CL_DEVICE_MEM_POOL_CACHED_BYTES_SNUCL, size_t,
+                      mem_pool_->cached_bytes());
+    GET_OBJECT_INFO_T(CL_DEVICE_MEM_POOL_ALLOC_COUNT_SNUCL, cl_ulong,
+                      mem_pool_->num_allocs());
+    GET_OBJECT_INFO_T(CL_DEVICE_MEM_POOL_REUSE_COUNT_SNUCL, cl_ulong,
+                      mem_pool_->num_reuses());
+
+    default:
+      return GetDeviceExtInfo(param_name, param_value_size, param_value,
+                              param_value_size_ret);
   }
   return CL_SUCCESS;
 }
 
+void CLDevice::CountReadCacheAccess(bool hit, size_t size) {
+  if (hit) {
+    __sync_fetch_and_add(&read_cache_hits_, 1);
+    __sync_fetch_and_add(&read_cache_hit_bytes_, size);
+  } else {
+    __sync_fetch_and_add(&read_cache_misses_, 1);
+  }
+}
+
+cl_int CLDevice::GetDeviceExtInfo(cl_device_info param_name,
+                                  size_t param_value_size, void* param_value,
+                                  size_t* param_value_size_ret) {
+  return CL_INVALID_VALUE;
+}
+
 cl_int CLDevice::CreateSubDevices(
     const cl_device_partition_property* properties, cl_uint num_devices,
     cl_device_id* out_devices, cl_uint* num_devices_ret) {
@@ -721,25 +770,61 @@ void CLDevice::InvokeScheduler() {
   scheduler_->Invoke();
 }
 
+static bool IsTransferCommand(cl_command_type type) {
+  switch (type) {
+    case CL_COMMAND_READ_BUFFER:
+    case CL_COMMAND_WRITE_BUFFER:
+    case CL_COMMAND_COPY_BUFFER:
+    case CL_COMMAND_READ_IMAGE:
+    case CL_COMMAND_WRITE_IMAGE:
+    case CL_COMMAND_COPY_IMAGE:
+    case CL_COMMAND_COPY_IMAGE_TO_BUFFER:
+    case CL_COMMAND_COPY_BUFFER_TO_IMAGE:
+    case CL_COMMAND_READ_BUFFER_RECT:
+    case CL_COMMAND_WRITE_BUFFER_RECT:
+    case CL_COMMAND_COPY_BUFFER_RECT:
+    case CL_COMMAND_FILL_BUFFER:
+    case CL_COMMAND_MAP_BUFFER:
+    case CL_COMMAND_MAP_IMAGE:
+    case CL_COMMAND_UNMAP_MEM_OBJECT:
+    case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+      return true;
+    default:
+      return false;
+  }
+}
+
 void CLDevice::EnqueueReadyQueue(CLCommand* command) {
+  if (copy_lane_enabled_ && IsTransferCommand(command->type())) {
+    while (!copy_queue_.Enqueue(command)) {}
+    sem_post(&sem_copy_queue_);
+    return;
+  }
   while (!ready_queue_.Enqueue(command)) {}
   sem_post(&sem_ready_queue_);
 }
 
-CLCommand* CLDevice::DequeueReadyQueue() {
+CLCommand* CLDevice::DequeueReadyQueue(bool copy_lane) {
   CLCommand* command;
-  if (ready_queue_.Dequeue(&command))
+  LockFreeQueueMS* queue = (copy_lane ? &copy_queue_ : &ready_queue_);
+  if (queue->Dequeue(&command))
     return command;
   else
     return NULL;
 }
 
-void CLDevice::InvokeReadyQueue() {
-  sem_post(&sem_ready_queue_);
+void CLDevice::InvokeReadyQueue(bool copy_lane) {
+  sem_post(copy_lane ? &sem_copy_queue_ : &sem_ready_queue_);
 }
 
-void CLDevice::WaitReadyQueue() {
-  sem_wait(&sem_ready_queue_);
+void CLDevice::WaitReadyQueue(bool copy_lane) {
+  sem_wait(copy_lane ? &sem_copy_queue_ : &sem_ready_queue_);
+}
+
+void CLDevice::EnableCopyLane() {
+  if (copy_lane_enabled_) return;
+  copy_lane_enabled_ = true;
+  CLPlatform::GetPlatform()->AddCopyLane(this);
 }
 
 CLEvent* CLDevice::EnqueueBuildProgram(CLProgram* program,
@@ -801,7 +886,10 @@ void CLDevice::UnmapMemObject(CLCommand* command, CLMem* mem_src,
     }
   } else {
     size_t offset, size;
-    if (mem_src->GetMapWritebackLayoutForBuffer(mapped_ptr, &offset, &size)) {
+    // The host memory of a USE_HOST_PTR buffer is uploaded when a device
+    // uses it next
+    if (mem_src->GetMapWritebackLayoutForBuffer(mapped_ptr, &offset, &size) &&
+        !mem_src->IsUseHostPtr()) {
       WriteBuffer(NULL, mem_src, offset, size, mapped_ptr);
     }
   }
@@ -811,6 +899,9 @@ void CLDevice::UnmapMemObject(CLCommand* command, CLMem* mem_src,
 void CLDevice::MigrateMemObjects(CLCommand* command, cl_uint num_mem_objects,
                                  CLMem** mem_list,
                                  cl_mem_migration_flags flags) {
+  // The data movement itself is issued while resolving consistency
+  if (flags & CL_MIGRATE_MEM_OBJECT_HOST)
+    return;
   for (cl_uint i = 0; i < num_mem_objects; i++) {
     mem_list[i]->GetDevSpecific(this);
   }
@@ -820,6 +911,33 @@ bool CLDevice::IsComplete(CLCommand* command) {
   return true;
 }
 
+void* CLDevice::AllocMapPtr(CLMem* mem, size_t offset, size_t size) {
+  return NULL;
+}
+
+void CLDevice::FreeMapPtr(void* ptr) {
+  // Do nothing
+}
+
+int CLDevice::GetMemBank(CLMem* mem) {
+  return -1;
+}
+
+int CLDevice::GetNumMemBanks() {
+  return 1;
+}
+
+void CLDevice::CompactMem() {
+}
+
+bool CLDevice::RegisterHostMem(void* ptr, size_t size) {
+  return true;
+}
+
+bool CLDevice::UnregisterHostMem(void* ptr) {
+  return true;
+}
+
 void* CLDevice::AllocSampler(CLSampler* sampler) {
   return NULL;
 }
@@ -52,12 +52,17 @@
 #include "Structs.h"
 #include "Utils.h"
 
+// Devices get dense indices starting from 1 so that per-device state can be
+// kept in fixed arrays and bitmasks. Index 0 stands for the host.
+#define MAX_NUM_DEVICES 63
+
 class CLCommand;
 class CLCommandQueue;
 class CLEvent;
 class CLFile;
 class CLKernel;
 class CLKernelArgs;
+class CLMemPool;
 class CLPlatform;
 class CLProgram;
 class CLProgramBinary;
@@ -73,9 +78,15 @@ class CLDevice: public CLObject<struct _cl_device_id, CLDevice> {
 
   cl_device_type type() const { return type_; }
   int node_id() const { return node_id_; }
+  int index() const { return index_; }
+  void set_index(int index) { index_ = index; }
+  CLMemPool* mem_pool() const { return mem_pool_; }
 
   cl_int GetDeviceInfo(cl_device_info param_name, size_t param_value_size,
                        void* param_value, size_t* param_value_size_ret);
+  virtual cl_int GetDeviceExtInfo(cl_device_info param_name,
+                                  size_t param_value_size, void* param_value,
+                                  size_t* param_value_size_ret);
   cl_int CreateSubDevices(const cl_device_partition_property* properties,
                           cl_uint num_devices, cl_device_id* out_devices,
                           cl_uint* num_devices_ret);
@@ -105,9 +116,13 @@ class CLDevice: public CLObject<struct _cl_device_id, CLDevice> {
   void InvokeScheduler();
 
   void EnqueueReadyQueue(CLCommand* command);
-  CLCommand* DequeueReadyQueue();
-  void InvokeReadyQueue();
-  void WaitReadyQueue();
+  CLCommand* DequeueReadyQueue(bool copy_lane = false);
+  void InvokeReadyQueue(bool copy_lane = false);
+  void WaitReadyQueue(bool copy_lane = false);
+  bool HasCopyLane() const { return copy_lane_enabled_; }
+
+  // Reads of device buffers served from the host shadow
+  void CountReadCacheAccess(bool hit, size_t size);
 
   CLEvent* EnqueueBuildProgram(CLProgram* program, CLProgramSource* source,
                                CLProgramBinary* binary, const char* options);
@@ -214,6 +229,16 @@ class CLDevice: public CLObject<struct _cl_device_id, CLDevice> {
 
   virtual void* AllocMem(CLMem* mem) = 0;
   virtual void FreeMem(CLMem* mem, void* dev_specific) = 0;
+  virtual void* AllocMapPtr(CLMem* mem, size_t offset, size_t size);
+  virtual void FreeMapPtr(void* ptr);
+  virtual int GetMemBank(CLMem* mem);
+  virtual int GetNumMemBanks();
+  // Called at barriers to defragment the device memory
+  virtual void CompactMem();
+  // Returns false if the range overlaps a registered one
+  virtual bool RegisterHostMem(void* ptr, size_t size);
+  // Returns false if the range is not registered
+  virtual bool UnregisterHostMem(void* ptr);
   virtual void* AllocSampler(CLSampler* sampler);
   virtual void FreeSampler(CLSampler* sampler, void* dev_specific);
 
@@ -238,10 +263,24 @@ class CLDevice: public CLObject<struct _cl_device_id, CLDevice> {
   CLScheduler* scheduler_;
   LockFreeQueueMS ready_queue_;
   int node_id_;
+  int index_;
   CLDevice* parent_;
 
   sem_t sem_ready_queue_;
 
+  // Transfer commands go to a separate lane so that they overlap kernels
+  void EnableCopyLane();
+  bool copy_lane_enabled_;
+  LockFreeQueueMS copy_queue_;
+  sem_t sem_copy_queue_;
+
+  cl_ulong read_cache_hits_;
+  cl_ulong read_cache_misses_;
+  cl_ulong read_cache_hit_bytes_;
+
+  // Buffers of clEnqueueAllocBuffer
+  CLMemPool* mem_pool_;
+
   cl_device_type type_;
   cl_uint vendor_id_;
   cl_uint max_compute_units_;
@@ -0,0 +1,253 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#include "CLDirtyTracker.h"
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Utils.h"
+
+using namespace std;
+
+// Pages unprotected by a runtime thread until the thread reprotects them
+#define MAX_RUNTIME_PAGES 256
+
+static __thread bool runtime_thread = false;
+static __thread int num_runtime_pages = 0;
+static __thread size_t runtime_pages[MAX_RUNTIME_PAGES];
+
+CLDirtyTracker::CLDirtyTracker() {
+  char* tracking = getenv("SNUCL_DIRTY_TRACKING");
+  enabled_ = (tracking != NULL && atoi(tracking) != 0);
+  page_size_ = sysconf(_SC_PAGESIZE);
+  memset(regions_, 0, sizeof(regions_));
+  num_regions_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+
+  if (enabled_) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = &CLDirtyTracker::HandleFault;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &old_action_) != 0) {
+      SNUCL_ERROR("Failed to install the dirty page handler");
+      enabled_ = false;
+    }
+  }
+}
+
+CLDirtyTracker::~CLDirtyTracker() {
+  if (enabled_)
+    sigaction(SIGSEGV, &old_action_, NULL);
+  for (int i = 0; i < num_regions_; i++)
+    free((void*)regions_[i].dirty);
+  pthread_mutex_destroy(&mutex_);
+}
+
+int CLDirtyTracker::Register(void* ptr, size_t size) {
+  if (!enabled_ || size == 0)
+    return -1;
+  size_t begin = (size_t)ptr;
+  size_t end = begin + size;
+
+  pthread_mutex_lock(&mutex_);
+  int slot = -1;
+  for (int i = 0; i < num_regions_; i++) {
+    if (regions_[i].end == 0) {
+      if (slot == -1)
+        slot = i;
+    } else if (begin < regions_[i].end && regions_[i].begin < end) {
+      // Two buffers on the same host memory cannot share the dirty bits
+      pthread_mutex_unlock(&mutex_);
+      return -1;
+    }
+  }
+  if (slot == -1) {
+    if (num_regions_ == MAX_TRACKED_REGIONS) {
+      pthread_mutex_unlock(&mutex_);
+      return -1;
+    }
+    slot = num_regions_;
+  }
+
+  // A freed bitmap may still be touched by a late fault, so it is reused
+  // rather than freed when the region is unregistered
+  TrackedRegion& region = regions_[slot];
+  size_t num_words = (size / page_size_ + 63) / 64;
+  if (region.num_words < num_words) {
+    free((void*)region.dirty);
+    region.dirty = (volatile uint64_t*)calloc(num_words, sizeof(uint64_t));
+    region.num_words = num_words;
+  } else {
+    memset((void*)region.dirty, 0, region.num_words * sizeof(uint64_t));
+  }
+  region.begin = begin;
+  __sync_synchronize();
+  region.end = end;
+  if (slot == num_regions_)
+    num_regions_++;
+  __sync_synchronize();
+
+  if (mprotect(ptr, size, PROT_READ) != 0) {
+    region.end = 0;
+    slot = -1;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return slot;
+}
+
+void CLDirtyTracker::Unregister(int slot) {
+  pthread_mutex_lock(&mutex_);
+  TrackedRegion& region = regions_[slot];
+  mprotect((void*)region.begin, region.end - region.begin,
+           PROT_READ | PROT_WRITE);
+  region.end = 0;
+  __sync_synchronize();
+  pthread_mutex_unlock(&mutex_);
+}
+
+void CLDirtyTracker::CollectDirtyPages(int slot,
+                                       vector<pair<size_t, size_t> >& ranges) {
+  pthread_mutex_lock(&mutex_);
+  TrackedRegion& region = regions_[slot];
+  size_t num_words = ((region.end - region.begin) / page_size_ + 63) / 64;
+  size_t first = ranges.size();
+  for (size_t w = 0; w < num_words; w++) {
+    if (region.dirty[w] == 0)
+      continue;
+    uint64_t bits = __sync_fetch_and_and(&region.dirty[w], 0);
+    while (bits != 0) {
+      size_t offset = (w * 64 + __builtin_ctzll(bits)) * page_size_;
+      bits &= bits - 1;
+      if (ranges.size() > first &&
+          ranges.back().first + ranges.back().second == offset)
+        ranges.back().second += page_size_;
+      else
+        ranges.push_back(make_pair(offset, page_size_));
+    }
+  }
+  for (size_t i = first; i < ranges.size(); i++) {
+    mprotect((void*)(region.begin + ranges[i].first), ranges[i].second,
+             PROT_READ);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+int CLDirtyTracker::FindRegion(size_t addr) {
+  int num_regions = num_regions_;
+  for (int i = 0; i < num_regions; i++) {
+    size_t end = regions_[i].end;
+    if (end != 0 && addr >= regions_[i].begin && addr < end)
+      return i;
+  }
+  return -1;
+}
+
+void CLDirtyTracker::HandleFault(int sig, siginfo_t* info, void* context) {
+  CLDirtyTracker* tracker = singleton_;
+  size_t addr = (size_t)info->si_addr;
+  int slot = (info->si_code == SEGV_ACCERR ? tracker->FindRegion(addr) : -1);
+  if (slot != -1) {
+    TrackedRegion& region = tracker->regions_[slot];
+    size_t page = (addr - region.begin) / tracker->page_size_;
+    size_t page_addr = region.begin + page * tracker->page_size_;
+    if (runtime_thread && num_runtime_pages < MAX_RUNTIME_PAGES) {
+      runtime_pages[num_runtime_pages++] = page_addr;
+    } else {
+      __sync_fetch_and_or(&region.dirty[page / 64],
+                          (uint64_t)1 << (page % 64));
+    }
+    mprotect((void*)page_addr, tracker->page_size_, PROT_READ | PROT_WRITE);
+    return;
+  }
+
+  // Not a tracked page
+  struct sigaction& old_action = tracker->old_action_;
+  if (old_action.sa_flags & SA_SIGINFO) {
+    old_action.sa_sigaction(sig, info, context);
+  } else if (old_action.sa_handler != SIG_DFL &&
+             old_action.sa_handler != SIG_IGN) {
+    old_action.sa_handler(sig);
+  } else {
+    // The faulting instruction traps again and terminates the process
+    signal(sig, SIG_DFL);
+  }
+}
+
+void CLDirtyTracker::EnterRuntimeThread() {
+  runtime_thread = true;
+}
+
+void CLDirtyTracker::ReprotectRuntimePages() {
+  if (num_runtime_pages == 0)
+    return;
+  CLDirtyTracker* tracker = singleton_;
+  pthread_mutex_lock(&tracker->mutex_);
+  for (int i = 0; i < num_runtime_pages; i++) {
+    size_t page_addr = runtime_pages[i];
+    int slot = tracker->FindRegion(page_addr);
+    if (slot == -1)
+      continue;
+    // Pages the application has written stay writable until collected
+    TrackedRegion& region = tracker->regions_[slot];
+    size_t page = (page_addr - region.begin) / tracker->page_size_;
+    if (region.dirty[page / 64] & ((uint64_t)1 << (page % 64)))
+      continue;
+    mprotect((void*)page_addr, tracker->page_size_, PROT_READ);
+  }
+  num_runtime_pages = 0;
+  pthread_mutex_unlock(&tracker->mutex_);
+}
+
+CLDirtyTracker* CLDirtyTracker::singleton_ = NULL;
+
+CLDirtyTracker* CLDirtyTracker::GetTracker() {
+  if (singleton_ == NULL)
+    singleton_ = new CLDirtyTracker();
+  return singleton_;
+}
@@ -0,0 +1,107 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#ifndef __SNUCL__CL_DIRTY_TRACKER_H
+#define __SNUCL__CL_DIRTY_TRACKER_H
+
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+// Finds the pages of host-backed buffers that the application writes, so that
+// only those pages are uploaded again. Enabled by SNUCL_DIRTY_TRACKING.
+//
+// Tracked pages are write-protected. The first write to a page traps, marks
+// the page dirty and lifts the protection until the page is collected. Writes
+// of the runtime threads themselves (e.g., downloads into the host copy) do
+// not mark pages dirty. System calls that write into a protected page fail
+// with EFAULT instead of trapping, which is why tracking is opt-in.
+class CLDirtyTracker {
+ private:
+  CLDirtyTracker();
+
+ public:
+  ~CLDirtyTracker();
+
+  bool enabled() const { return enabled_; }
+  size_t page_size() const { return page_size_; }
+
+  // Returns -1 if the page-aligned range cannot be tracked
+  int Register(void* ptr, size_t size);
+  void Unregister(int slot);
+  // Returns the dirty pages as (offset, size) from the start of the range
+  // and protects them again
+  void CollectDirtyPages(int slot,
+                         std::vector<std::pair<size_t, size_t> >& ranges);
+
+  static void EnterRuntimeThread();
+  static void ReprotectRuntimePages();
+
+ private:
+  static const int MAX_TRACKED_REGIONS = 1024;
+
+  typedef struct _TrackedRegion {
+    volatile size_t begin;
+    volatile size_t end; // 0 if the slot is free
+    volatile uint64_t* dirty; // a bit per page
+    size_t num_words;
+  } TrackedRegion;
+
+  int FindRegion(size_t addr);
+  static void HandleFault(int sig, siginfo_t* info, void* context);
+
+  bool enabled_;
+  size_t page_size_;
+  TrackedRegion regions_[MAX_TRACKED_REGIONS];
+  volatile int num_regions_; // high-water mark of the used slots
+  struct sigaction old_action_;
+  pthread_mutex_t mutex_;
+
+ public:
+  static CLDirtyTracker* GetTracker();
+
+ private:
+  static CLDirtyTracker* singleton_;
+};
+
+#endif // __SNUCL__CL_DIRTY_TRACKER_H
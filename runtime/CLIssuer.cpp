@@ -46,12 +46,14 @@
 #include <pthread.h>
 #include "CLCommand.h"
 #include "CLDevice.h"
+#include "CLDirtyTracker.h"
 #include "CLEvent.h"
 
 using namespace std;
 
-CLIssuer::CLIssuer(CLDevice* device, bool blocking) {
+CLIssuer::CLIssuer(CLDevice* device, bool blocking, bool copy_lane) {
   blocking_ = blocking;
+  copy_lane_ = copy_lane;
   devices_.push_back(device);
   devices_updated_ = true;
 
@@ -64,6 +66,7 @@ CLIssuer::CLIssuer(CLDevice* device, bool blocking) {
 
 CLIssuer::CLIssuer(bool blocking) {
   blocking_ = blocking;
+  copy_lane_ = false;
 
   thread_ = (pthread_t)NULL;
   thread_running_ = false;
@@ -93,7 +96,7 @@ void CLIssuer::Stop() {
     for (vector<CLDevice*>::iterator it = devices_.begin();
          it != devices_.end();
          ++it) {
-      (*it)->InvokeReadyQueue();
+      (*it)->InvokeReadyQueue(copy_lane_);
     }
     pthread_mutex_unlock(&mutex_devices_);
     pthread_join(thread_, NULL);
@@ -139,6 +142,7 @@ void CLIssuer::RemoveDevice(CLDevice* device) {
 
 void CLIssuer::Run() {
   vector<CLDevice*> target_devices;
+  CLDirtyTracker::EnterRuntimeThread();
   while (thread_running_) {
     if (devices_updated_) {
       pthread_mutex_lock(&mutex_devices_);
@@ -155,15 +159,17 @@ void CLIssuer::Run() {
          ++it) {
       CLDevice* device = *it;
       if (blocking_)
-        device->WaitReadyQueue();
-      CLCommand* command = device->DequeueReadyQueue();
+        device->WaitReadyQueue(copy_lane_);
+      CLCommand* command = device->DequeueReadyQueue(copy_lane_);
       if (command != NULL) {
         command->SetAsRunning();
         if (!blocking_) {
           running_commands_.push_back(command);
           command->Execute();
+          CLDirtyTracker::ReprotectRuntimePages();
         } else {
           command->Execute();
+          CLDirtyTracker::ReprotectRuntimePages();
           command->SetAsComplete();
           delete command;
         }
@@ -51,7 +51,7 @@ class CLDevice;
 
 class CLIssuer {
  public:
-  CLIssuer(CLDevice* device, bool blocking);
+  CLIssuer(CLDevice* device, bool blocking, bool copy_lane = false);
   CLIssuer(bool blocking);
   ~CLIssuer();
 
@@ -66,6 +66,7 @@ class CLIssuer {
   void Run();
 
   bool blocking_;
+  bool copy_lane_;
   std::vector<CLDevice*> devices_;
   bool devices_updated_;
 
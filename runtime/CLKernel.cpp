@@ -133,6 +133,10 @@ cl_int CLKernel::GetKernelArgInfo(cl_uint arg_index,
                                         param_value_size_ret);
 }
 
+bool CLKernel::IsArgReadOnly(cl_uint arg_index) const {
+  return kernel_info_->IsArgReadOnly(arg_index);
+}
+
 cl_int CLKernel::SetKernelArg(cl_uint arg_index, size_t arg_size,
                               const void* arg_value) {
   if (arg_size > 256 && arg_value != NULL)
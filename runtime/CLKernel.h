@@ -85,6 +85,7 @@ public:
   cl_int GetKernelArgInfo(cl_uint arg_index, cl_kernel_arg_info param_name,
                           size_t param_value_size, void* param_value,
                           size_t* param_value_size_ret);
+  bool IsArgReadOnly(cl_uint arg_index) const;
 
   cl_int SetKernelArg(cl_uint arg_index, size_t arg_size,
                       const void* arg_value);
@@ -40,17 +40,24 @@
 /*****************************************************************************/
 
 #include "CLMem.h"
+#include <algorithm>
 #include <cstring>
+#include <list>
 #include <map>
 #include <set>
 #include <vector>
 #include <malloc.h>
 #include <pthread.h>
+#include <sched.h>
 #include <CL/cl.h>
 #include "Callbacks.h"
 #include "CLContext.h"
 #include "CLDevice.h"
+#include "CLDirtyTracker.h"
+#include "CLEvent.h"
 #include "CLObject.h"
+#include "CLPlatform.h"
+#include "CLReadCache.h"
 #include "Structs.h"
 #include "Utils.h"
 
@@ -62,11 +69,25 @@ CLMem::CLMem(CLContext* context) {
   context_->AddMem(this);
 
   parent_ = NULL;
+  capacity_ = 0;
+  growable_ = false;
   host_ptr_ = NULL;
   alloc_host_ = use_host_ = false;
+  host_cached_ = false;
+  upload_shadow_ = false;
+  num_children_ = 0;
+  track_slot_ = -1;
+  track_begin_ = track_end_ = 0;
   map_count_ = 0;
+  in_use_ = 0;
+  dev_alloc_mask_ = 0;
+  dev_evicted_mask_ = 0;
+  dev_allocating_mask_ = 0;
+  latest_mask_ = 0;
+  num_pending_ = 0;
 
   pthread_mutex_init(&mutex_dev_specific_, NULL);
+  pthread_cond_init(&cond_dev_specific_, NULL);
   pthread_mutex_init(&mutex_dev_latest_, NULL);
   pthread_mutex_init(&mutex_host_ptr_, NULL);
   pthread_mutex_init(&mutex_map_, NULL);
@@ -74,26 +95,51 @@ CLMem::CLMem(CLContext* context) {
 }
 
 void CLMem::Cleanup() {
+  // Takes the object for good so that eviction, compaction, and the read
+  // cache skip it from now on
+  while (!TryBeginEvict())
+    sched_yield();
+  if (host_cached_)
+    CLReadCache::GetCache()->Remove(this);
+  if (track_slot_ != -1)
+    CLDirtyTracker::GetTracker()->Unregister(track_slot_);
   for (vector<MemObjectDestructorCallback*>::iterator it = callbacks_.begin();
        it != callbacks_.end();
        ++it) {
     (*it)->run(st_obj());
     free(*it);
   }
-  for (map<CLDevice*, void*>::iterator it = dev_specific_.begin();
-       it != dev_specific_.end();
+  pthread_mutex_lock(&mutex_dev_specific_);
+  uint64_t mask = __sync_fetch_and_and(&dev_alloc_mask_, 0);
+  pthread_mutex_unlock(&mutex_dev_specific_);
+  while (mask != 0) {
+    int index = __builtin_ctzll(mask);
+    mask &= mask - 1;
+    CLDevice* device = GetLatestDevice(index);
+    if (device != NULL)
+      device->FreeMem(this, dev_specific_[index]);
+  }
+  pthread_mutex_lock(&mutex_dev_latest_);
+  for (list<CLPendingTransfer>::iterator it = pending_.begin();
+       it != pending_.end();
        ++it) {
-    (it->first)->FreeMem(this, it->second);
+    it->event->Release();
   }
+  pending_.clear();
+  pthread_mutex_unlock(&mutex_dev_latest_);
   context_->RemoveMem(this);
 }
 
 CLMem::~CLMem() {
   if (alloc_host_) free(host_ptr_);
-  if (parent_) parent_->Release();
+  if (parent_) {
+    __sync_fetch_and_sub(&parent_->num_children_, 1);
+    parent_->Release();
+  }
   context_->Release();
 
   pthread_mutex_destroy(&mutex_dev_specific_);
+  pthread_cond_destroy(&cond_dev_specific_);
   pthread_mutex_destroy(&mutex_dev_latest_);
   pthread_mutex_destroy(&mutex_host_ptr_);
   pthread_mutex_destroy(&mutex_map_);
@@ -114,6 +160,8 @@ cl_int CLMem::GetMemObjectInfo(cl_mem_info param_name, size_t param_value_size,
     GET_OBJECT_INFO_T(CL_MEM_ASSOCIATED_MEMOBJECT, cl_mem,
                       (parent_ == NULL ? NULL : parent_->st_obj()));
     GET_OBJECT_INFO(CL_MEM_OFFSET, size_t, offset_);
+    GET_OBJECT_INFO_T(CL_MEM_BANK_SNUCL, cl_int, GetMemBank());
+    GET_OBJECT_INFO_T(CL_MEM_RESERVED_SIZE_SNUCL, size_t, capacity());
     default: return CL_INVALID_VALUE;
   }
   return CL_SUCCESS;
@@ -208,115 +256,586 @@ void* CLMem::GetHostPtr() const {
 
 void CLMem::AllocHostPtr() {
   if (host_ptr_ == NULL) {
+    bool allocated = false;
     pthread_mutex_lock(&mutex_host_ptr_);
     if (host_ptr_ == NULL) {
       if (IsSubBuffer()) {
         parent_->AllocHostPtr();
         host_ptr_ = (void*)((size_t)parent_->host_ptr_ + offset_);
       } else {
-        host_ptr_ = memalign(4096, size_);
+        // Pages of the reserved range are not touched until committed
+        host_ptr_ = memalign(4096, capacity());
         alloc_host_ = true;
+        allocated = true;
       }
     }
     pthread_mutex_unlock(&mutex_host_ptr_);
+    // The shadow of a buffer can be reclaimed again while a device has the
+    // latest contents
+    if (allocated && IsBuffer() && !growable_ &&
+        CLReadCache::GetCache()->Admit(this))
+      host_cached_ = true;
+  }
+}
+
+void CLMem::SyncHostWrites() {
+  CLMem* root = GetRoot();
+  if (root->track_slot_ == -1)
+    return;
+  vector<pair<size_t, size_t> > pages;
+  CLDirtyTracker::GetTracker()->CollectDirtyPages(root->track_slot_, pages);
+  for (vector<pair<size_t, size_t> >::iterator it = pages.begin();
+       it != pages.end();
+       ++it) {
+    root->SetLatest(LATEST_HOST, root->track_begin_ + it->first, it->second);
+  }
+}
+
+void CLMem::MarkHostWritten(size_t offset, size_t size) {
+  CLMem* root = GetRoot();
+  if (root->track_slot_ == -1) {
+    SetLatest(LATEST_HOST, offset, size);
+    return;
+  }
+  SyncHostWrites();
+  // Partial pages at both ends of the host memory are not tracked
+  size_t begin = offset_ + offset;
+  size_t end = begin + size;
+  if (begin < root->track_begin_) {
+    root->SetLatest(LATEST_HOST, begin,
+                    min(end, root->track_begin_) - begin);
+  }
+  if (end > root->track_end_) {
+    size_t tail = max(begin, root->track_end_);
+    root->SetLatest(LATEST_HOST, tail, end - tail);
   }
 }
 
+// Returns true if the host shadow is available to keep the last read
+// contents of the object
+bool CLMem::AcquireHostCache() {
+  // Copying large objects to the host on every read costs more than it saves
+  if (!IsBuffer() || use_host_ || GetRoot()->growable_ ||
+      size_ > CLReadCache::GetCache()->capacity() / 4)
+    return false;
+  if (host_cached_) {
+    CLReadCache::GetCache()->Touch(this);
+    return true;
+  }
+  if (GetRoot()->host_ptr_ != NULL) {
+    AllocHostPtr();
+    return true;
+  }
+  if (IsSubBuffer() || !CLReadCache::GetCache()->Admit(this))
+    return false;
+  host_cached_ = true;
+  AllocHostPtr();
+  return true;
+}
+
+void CLMem::TouchHostCache() {
+  if (host_cached_)
+    CLReadCache::GetCache()->Touch(this);
+}
+
+// Called by the read cache to reclaim the host shadow
+bool CLMem::ReleaseHostCache() {
+  if (!TryBeginEvict())
+    return false;
+  bool release = true;
+  pthread_mutex_lock(&mutex_host_ptr_);
+  pthread_mutex_lock(&mutex_dev_latest_);
+  if (num_children_ > 0)
+    release = false;
+  for (list<CLPendingTransfer>::iterator it = pending_.begin();
+       release && it != pending_.end();
+       ++it) {
+    if (it->device == LATEST_HOST && !it->event->IsComplete())
+      release = false;
+  }
+  // Bit 0 alone means that the host holds the only copy
+  for (LatestMap::iterator it = latest_.begin();
+       release && it != latest_.end();
+       ++it) {
+    if (it->second == 1)
+      release = false;
+  }
+  if (release) {
+    for (LatestMap::iterator it = latest_.begin(); it != latest_.end(); ++it)
+      it->second &= ~(uint64_t)1;
+    MergeLatest(0, size_);
+    free(host_ptr_);
+    host_ptr_ = NULL;
+    alloc_host_ = false;
+    host_cached_ = false;
+  }
+  pthread_mutex_unlock(&mutex_dev_latest_);
+  pthread_mutex_unlock(&mutex_host_ptr_);
+  EndEvict();
+  return release;
+}
+
 bool CLMem::HasDevSpecific(CLDevice* device) {
-  pthread_mutex_lock(&mutex_dev_specific_);
-  bool alloc = (dev_specific_.count(device) > 0);
-  pthread_mutex_unlock(&mutex_dev_specific_);
-  return alloc;
+  return (dev_alloc_mask_ & ((uint64_t)1 << device->index())) != 0;
 }
 
+// The handle is published before its bit, so the fast path needs no lock
 void* CLMem::GetDevSpecific(CLDevice* device) {
+  int index = device->index();
+  uint64_t bit = (uint64_t)1 << index;
+  if (dev_alloc_mask_ & bit)
+    return dev_specific_[index];
+
+  // The lock is not held across AllocMem(), which may evict other objects.
+  // Other threads wait for the allocation in progress instead.
   pthread_mutex_lock(&mutex_dev_specific_);
-  void* dev_specific;
-  if (dev_specific_.count(device) > 0) {
-    dev_specific = dev_specific_[device];
-  } else {
+  while (!(dev_alloc_mask_ & bit) && (dev_allocating_mask_ & bit))
+    pthread_cond_wait(&cond_dev_specific_, &mutex_dev_specific_);
+  if (!(dev_alloc_mask_ & bit)) {
+    dev_allocating_mask_ |= bit;
     pthread_mutex_unlock(&mutex_dev_specific_);
-    dev_specific = device->AllocMem(this);
+    void* dev_specific = device->AllocMem(this);
     pthread_mutex_lock(&mutex_dev_specific_);
-    dev_specific_[device] = dev_specific;
+    dev_specific_[index] = dev_specific;
+    __sync_fetch_and_or(&dev_alloc_mask_, bit);
+    __sync_fetch_and_and(&dev_evicted_mask_, ~bit);
+    dev_allocating_mask_ &= ~bit;
+    pthread_cond_broadcast(&cond_dev_specific_);
   }
+  void* dev_specific = dev_specific_[index];
   pthread_mutex_unlock(&mutex_dev_specific_);
   return dev_specific;
 }
 
+void CLMem::EvictDevSpecific(CLDevice* device) {
+  uint64_t bit = (uint64_t)1 << device->index();
+  pthread_mutex_lock(&mutex_dev_specific_);
+  if (dev_alloc_mask_ & bit) {
+    __sync_fetch_and_and(&dev_alloc_mask_, ~bit);
+    __sync_fetch_and_or(&dev_evicted_mask_, bit);
+  }
+  pthread_mutex_unlock(&mutex_dev_specific_);
+  RemoveLatest(device);
+}
+
+// Called between TryBeginEvict() and EndEvict() after the device has moved
+// the contents
+void CLMem::RelocateDevSpecific(CLDevice* device, void* dev_specific) {
+  pthread_mutex_lock(&mutex_dev_specific_);
+  dev_specific_[device->index()] = dev_specific;
+  pthread_mutex_unlock(&mutex_dev_specific_);
+}
+
+bool CLMem::IsEvictedFrom(CLDevice* device) {
+  return (dev_evicted_mask_ & ((uint64_t)1 << device->index())) != 0;
+}
+
+// Returns the bank of the first device holding the object. An object that
+// is not placed yet reports the bank requested by its flags, or -1.
+int CLMem::GetMemBank() {
+  CLMem* root = GetRoot();
+  CLDevice* device = NULL;
+  uint64_t mask = root->dev_alloc_mask_;
+  if (mask != 0)
+    device = GetLatestDevice(__builtin_ctzll(mask));
+  if (device == NULL) {
+    cl_mem_flags bank_flags = root->flags_ & CL_MEM_BANK_SELECT_MASK_SNUCL;
+    return (bank_flags != 0 ? (int)(bank_flags >> 16) - 1 : -1);
+  }
+  // The address is read while the object cannot be evicted or moved
+  BeginUse();
+  int bank = (root->HasDevSpecific(device) ? device->GetMemBank(this) : -1);
+  EndUse();
+  return bank;
+}
+
+void CLMem::BeginUse() {
+  // A sub-buffer lives in the storage of its parent
+  if (parent_) parent_->BeginUse();
+  while (true) {
+    int cur_in_use = in_use_;
+    if (cur_in_use < 0) {
+      sched_yield();
+      continue;
+    }
+    if (__sync_bool_compare_and_swap(&in_use_, cur_in_use, cur_in_use + 1))
+      break;
+  }
+}
+
+void CLMem::EndUse() {
+  int in_use = __sync_sub_and_fetch(&in_use_, 1);
+  if (parent_)
+    parent_->EndUse();
+  else if (in_use == 0 && upload_shadow_)
+    ReleaseUploadShadow();
+}
+
+// True if another command may be using the object besides the caller
+bool CLMem::IsUsedByOthers() {
+  return GetRoot()->in_use_ > 1;
+}
+
+bool CLMem::TryBeginEvict() {
+  return __sync_bool_compare_and_swap(&in_use_, 0, -1);
+}
+
+void CLMem::EndEvict() {
+  __sync_bool_compare_and_swap(&in_use_, -1, 0);
+}
+
+// Called on the root with mutex_dev_latest_ held. Returns the segment that
+// starts at the given offset, splitting the one that contains it if needed.
+CLMem::LatestMap::iterator CLMem::SplitLatest(size_t offset) {
+  if (latest_.empty())
+    latest_[0] = 0;
+  LatestMap::iterator it = latest_.upper_bound(offset);
+  --it;
+  if (it->first == offset)
+    return it;
+  return latest_.insert(it, make_pair(offset, it->second));
+}
+
+// Called on the root with mutex_dev_latest_ held
+void CLMem::MergeLatest(size_t begin, size_t end) {
+  LatestMap::iterator it = latest_.lower_bound(begin);
+  if (it != latest_.begin())
+    --it;
+  while (it != latest_.end()) {
+    LatestMap::iterator next = it;
+    ++next;
+    if (next == latest_.end() || next->first > end)
+      break;
+    if (next->second == it->second)
+      latest_.erase(next);
+    else
+      it = next;
+  }
+  if (latest_.size() > 1)
+    latest_mask_ = LATEST_SEGMENTED;
+  else
+    latest_mask_ = (latest_.empty() ? 0 : latest_.begin()->second);
+}
+
+// Called on the root with mutex_dev_latest_ held. Returns the first segment
+// that overlaps the given offset.
+CLMem::LatestMap::iterator CLMem::FindLatest(size_t offset) {
+  LatestMap::iterator it = latest_.upper_bound(offset);
+  if (it != latest_.begin())
+    --it;
+  return it;
+}
+
+uint64_t CLMem::GetLatestBit(CLDevice* device) {
+  return (device == LATEST_HOST ? 1 : (uint64_t)1 << device->index());
+}
+
+CLDevice* CLMem::GetLatestDevice(int index) {
+  if (index == 0)
+    return LATEST_HOST;
+  return CLPlatform::GetPlatform()->GetDeviceByIndex(index);
+}
+
 bool CLMem::EmptyLatest() {
-  pthread_mutex_lock(&mutex_dev_latest_);
-  bool empty = dev_latest_.empty();
-  pthread_mutex_unlock(&mutex_dev_latest_);
+  CLMem* root = GetRoot();
+  uint64_t mask = root->latest_mask_;
+  if (!(mask & LATEST_SEGMENTED))
+    return (mask == 0);
+
+  size_t end = offset_ + size_;
+  bool empty = true;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  for (LatestMap::iterator it = root->FindLatest(offset_);
+       it != root->latest_.end() && it->first < end;
+       ++it) {
+    if (it->second != 0) {
+      empty = false;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
   return empty;
 }
 
+// Ranges that have never been written need not be present in the device
 bool CLMem::HasLatest(CLDevice* device) {
-  pthread_mutex_lock(&mutex_dev_latest_);
-  set<CLDevice*>::iterator it = dev_latest_.find(device);
-  bool find = (it != dev_latest_.end());
-  pthread_mutex_unlock(&mutex_dev_latest_);
+  return HasLatest(device, 0, size_);
+}
+
+bool CLMem::HasLatest(CLDevice* device, size_t offset, size_t size) {
+  CLMem* root = GetRoot();
+  uint64_t bit = GetLatestBit(device);
+  uint64_t mask = root->latest_mask_;
+  if (!(mask & LATEST_SEGMENTED))
+    return (mask == 0 || (mask & bit) != 0);
+
+  size_t begin = offset_ + offset;
+  size_t end = begin + size;
+  bool find = true;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  for (LatestMap::iterator it = root->FindLatest(begin);
+       it != root->latest_.end() && it->first < end;
+       ++it) {
+    if (it->second != 0 && !(it->second & bit)) {
+      find = false;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
   return find;
 }
 
 CLDevice* CLMem::FrontLatest() {
-  CLDevice* device = NULL;
-  pthread_mutex_lock(&mutex_dev_latest_);
-  if (!dev_latest_.empty())
-    device = *(dev_latest_.begin());
-  pthread_mutex_unlock(&mutex_dev_latest_);
-  return device;
+  CLMem* root = GetRoot();
+  uint64_t mask = root->latest_mask_;
+  if (mask & LATEST_SEGMENTED) {
+    size_t end = offset_ + size_;
+    mask = 0;
+    pthread_mutex_lock(&root->mutex_dev_latest_);
+    for (LatestMap::iterator it = root->FindLatest(offset_);
+         it != root->latest_.end() && it->first < end;
+         ++it) {
+      if (it->second != 0) {
+        mask = it->second;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&root->mutex_dev_latest_);
+  }
+  if (mask == 0)
+    return NULL;
+  return GetLatestDevice(__builtin_ctzll(mask));
 }
 
 void CLMem::AddLatest(CLDevice* device) {
-  pthread_mutex_lock(&mutex_dev_latest_);
-  dev_latest_.insert(device);
-  pthread_mutex_unlock(&mutex_dev_latest_);
+  AddLatest(device, 0, size_);
+}
+
+void CLMem::AddLatest(CLDevice* device, size_t offset, size_t size) {
+  AddLatestMask(GetLatestBit(device), offset, size);
+}
+
+void CLMem::AddLatest(const vector<CLDevice*>& devices, size_t offset,
+                      size_t size) {
+  uint64_t mask = 0;
+  for (vector<CLDevice*>::const_iterator it = devices.begin();
+       it != devices.end();
+       ++it) {
+    mask |= GetLatestBit(*it);
+  }
+  AddLatestMask(mask, offset, size);
+}
+
+void CLMem::AddLatestMask(uint64_t mask, size_t offset, size_t size) {
+  if (size == 0) return;
+  CLMem* root = GetRoot();
+  size_t begin = offset_ + offset;
+  size_t end = begin + size;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  LatestMap::iterator first = root->SplitLatest(begin);
+  LatestMap::iterator last = (end < root->size_ ? root->SplitLatest(end) :
+                                                  root->latest_.end());
+  for (LatestMap::iterator it = first; it != last; ++it)
+    it->second |= mask;
+  root->MergeLatest(begin, end);
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
 }
 
 void CLMem::SetLatest(CLDevice* device) {
-  pthread_mutex_lock(&mutex_dev_latest_);
-  dev_latest_.clear();
-  dev_latest_.insert(device);
-  pthread_mutex_unlock(&mutex_dev_latest_);
+  SetLatest(device, 0, size_);
 }
 
-CLDevice* CLMem::GetNearestLatest(CLDevice* device) {
+void CLMem::SetLatest(CLDevice* device, size_t offset, size_t size) {
+  if (size == 0) return;
+  CLMem* root = GetRoot();
+  uint64_t bit = GetLatestBit(device);
+  size_t begin = offset_ + offset;
+  size_t end = begin + size;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  LatestMap::iterator first = root->SplitLatest(begin);
+  LatestMap::iterator last = (end < root->size_ ? root->SplitLatest(end) :
+                                                  root->latest_.end());
+  for (LatestMap::iterator it = first; it != last; ++it)
+    it->second = bit;
+  root->MergeLatest(begin, end);
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
+}
+
+void CLMem::RemoveLatest(CLDevice* device) {
+  CLMem* root = GetRoot();
+  uint64_t bit = GetLatestBit(device);
+  size_t begin = offset_;
+  size_t end = begin + size_;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  if (!root->latest_.empty()) {
+    LatestMap::iterator first = root->SplitLatest(begin);
+    LatestMap::iterator last = (end < root->size_ ? root->SplitLatest(end) :
+                                                    root->latest_.end());
+    for (LatestMap::iterator it = first; it != last; ++it)
+      it->second &= ~bit;
+    root->MergeLatest(begin, end);
+  }
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
+}
+
+// Called with mutex_dev_latest_ of the root held if the state is segmented
+CLDevice* CLMem::GetNearestLatest(CLDevice* device, uint64_t mask) {
+  if (device == LATEST_HOST)
+    return GetLatestDevice(__builtin_ctzll(mask));
   CLDevice* nearest = NULL;
   int min_distance = 10; // INF
-  pthread_mutex_lock(&mutex_dev_latest_);
-  for (set<CLDevice*>::iterator it = dev_latest_.begin();
-       it != dev_latest_.end();
-       ++it) {
-    int distance = device->GetDistance(*it);
+  while (mask != 0) {
+    int index = __builtin_ctzll(mask);
+    mask &= mask - 1;
+    CLDevice* other = GetLatestDevice(index);
+    int distance = device->GetDistance(other);
     if (distance < min_distance) {
-      nearest = *it;
+      nearest = other;
       min_distance = distance;
-    } 
+    }
   }
-  pthread_mutex_unlock(&mutex_dev_latest_);
   return nearest;
 }
 
-void* CLMem::MapAsBuffer(cl_map_flags map_flags, size_t offset, size_t size) {
+// Returns the ranges whose latest contents are not in the device, each with
+// the nearest device that has them
+void CLMem::GetMissingRanges(CLDevice* device, vector<CLMemRange>& ranges) {
+  CLMem* root = GetRoot();
+  uint64_t bit = GetLatestBit(device);
+  uint64_t mask = root->latest_mask_;
+  if (!(mask & LATEST_SEGMENTED)) {
+    if (mask != 0 && !(mask & bit)) {
+      CLMemRange range = {0, size_, GetNearestLatest(device, mask)};
+      ranges.push_back(range);
+    }
+    return;
+  }
+
+  size_t end = offset_ + size_;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  for (LatestMap::iterator it = root->FindLatest(offset_);
+       it != root->latest_.end() && it->first < end;
+       ++it) {
+    if (it->second == 0 || (it->second & bit))
+      continue;
+    CLDevice* nearest = GetNearestLatest(device, it->second);
+    LatestMap::iterator next = it;
+    ++next;
+    size_t seg_begin = max(it->first, offset_);
+    size_t seg_end = min(next == root->latest_.end() ? root->size_ :
+                                                       next->first, end);
+    if (!ranges.empty() && ranges.back().source == nearest &&
+        offset_ + ranges.back().offset + ranges.back().size == seg_begin) {
+      ranges.back().size += seg_end - seg_begin;
+    } else {
+      CLMemRange range = {seg_begin - offset_, seg_end - seg_begin, nearest};
+      ranges.push_back(range);
+    }
+  }
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
+}
+
+// Returns the ranges whose only latest copy is in the device
+void CLMem::GetExclusiveRanges(CLDevice* device, vector<CLMemRange>& ranges) {
+  CLMem* root = GetRoot();
+  uint64_t bit = GetLatestBit(device);
+  size_t end = offset_ + size_;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  for (LatestMap::iterator it = root->FindLatest(offset_);
+       it != root->latest_.end() && it->first < end;
+       ++it) {
+    if (it->second != bit)
+      continue;
+    LatestMap::iterator next = it;
+    ++next;
+    size_t seg_begin = max(it->first, offset_);
+    size_t seg_end = min(next == root->latest_.end() ? root->size_ :
+                                                       next->first, end);
+    CLMemRange range = {seg_begin - offset_, seg_end - seg_begin, device};
+    ranges.push_back(range);
+  }
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
+}
+
+void CLMem::SetPendingEvent(CLDevice* device, size_t offset, size_t size,
+                            CLEvent* event) {
+  CLMem* root = GetRoot();
+  CLPendingTransfer transfer = {device, offset_ + offset, size, event};
+  event->Retain();
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  list<CLPendingTransfer>::iterator it = root->pending_.begin();
+  while (it != root->pending_.end()) {
+    if (it->event->IsComplete()) {
+      it->event->Release();
+      it = root->pending_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  root->pending_.push_back(transfer);
+  root->num_pending_ = root->pending_.size();
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
+}
+
+// Collects retained events of the transfers into the given range of the
+// device that are still in flight
+void CLMem::GetPendingEvents(CLDevice* device, size_t offset, size_t size,
+                             vector<CLEvent*>& events) {
+  CLMem* root = GetRoot();
+  if (root->num_pending_ == 0)
+    return;
+  size_t begin = offset_ + offset;
+  size_t end = begin + size;
+  pthread_mutex_lock(&root->mutex_dev_latest_);
+  list<CLPendingTransfer>::iterator it = root->pending_.begin();
+  while (it != root->pending_.end()) {
+    if (it->event->IsComplete()) {
+      it->event->Release();
+      it = root->pending_.erase(it);
+      continue;
+    }
+    if (it->device == device && it->offset < end &&
+        begin < it->offset + it->size) {
+      it->event->Retain();
+      events.push_back(it->event);
+    }
+    ++it;
+  }
+  root->num_pending_ = root->pending_.size();
+  pthread_mutex_unlock(&root->mutex_dev_latest_);
+}
+
+void* CLMem::MapAsBuffer(CLDevice* device, cl_map_flags map_flags,
+                         size_t offset, size_t size) {
   Retain();
 
   void* ptr;
-  if (use_host_)
+  bool pinned = false;
+  if (use_host_) {
     ptr = (void*)((size_t)host_ptr_ + offset);
-  else
-    ptr = malloc(size);
+  } else {
+    // Prefer a pinned region of the device so that the map and unmap
+    // transfers do not need an intermediate copy
+    ptr = device->AllocMapPtr(this, offset, size);
+    if (ptr != NULL)
+      pinned = true;
+    else
+      ptr = malloc(size);
+  }
 
   CLMapWritebackLayout wb_layout;
   wb_layout.origin[0] = offset;
   wb_layout.region[0] = size;
+  wb_layout.map_flags = map_flags;
 
   pthread_mutex_lock(&mutex_map_);
   map_count_++;
-  if (!use_host_ &&
-      map_flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION)) {
+  if (pinned)
+    map_device_[ptr] = device;
+  // A USE_HOST_PTR buffer also keeps the layout, which tells the unmap which
+  // range the application may have written
+  if (map_flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
     map_writeback_[ptr] = wb_layout;
-  }
   pthread_mutex_unlock(&mutex_map_);
   return ptr;
 }
@@ -378,6 +897,7 @@ void* CLMem::MapAsImage(cl_map_flags map_flags, const size_t* origin,
   CLMapWritebackLayout wb_layout;
   memcpy(wb_layout.origin, origin, sizeof(size_t) * 3);
   memcpy(wb_layout.region, region, sizeof(size_t) * 3);
+  wb_layout.map_flags = map_flags;
 
   pthread_mutex_lock(&mutex_map_);
   map_count_++;
@@ -393,6 +913,26 @@ bool CLMem::IsMapInitRequired(void* ptr) {
   return !use_host_;
 }
 
+bool CLMem::IsMapWritebackAll(void* ptr) {
+  bool all = false;
+  pthread_mutex_lock(&mutex_map_);
+  map<void*, CLMapWritebackLayout>::iterator it = map_writeback_.find(ptr);
+  if (it != map_writeback_.end()) {
+    CLMapWritebackLayout& wb_layout = it->second;
+    if (IsImage()) {
+      all = (wb_layout.origin[0] == 0 && wb_layout.origin[1] == 0 &&
+             wb_layout.origin[2] == 0 &&
+             wb_layout.region[0] == image_region_[0] &&
+             wb_layout.region[1] == image_region_[1] &&
+             wb_layout.region[2] == image_region_[2]);
+    } else {
+      all = (wb_layout.origin[0] == 0 && wb_layout.region[0] == size_);
+    }
+  }
+  pthread_mutex_unlock(&mutex_map_);
+  return all;
+}
+
 bool CLMem::GetMapWritebackLayoutForBuffer(void* ptr, size_t* offset,
                                            size_t* size) {
   bool required = false;
@@ -407,6 +947,20 @@ bool CLMem::GetMapWritebackLayoutForBuffer(void* ptr, size_t* offset,
   return required;
 }
 
+bool CLMem::PeekMapWritebackLayoutForBuffer(void* ptr, size_t* offset,
+                                            size_t* size) {
+  bool required = false;
+  pthread_mutex_lock(&mutex_map_);
+  map<void*, CLMapWritebackLayout>::iterator it = map_writeback_.find(ptr);
+  if (it != map_writeback_.end()) {
+    required = true;
+    *offset = it->second.origin[0];
+    *size = it->second.region[0];
+  }
+  pthread_mutex_unlock(&mutex_map_);
+  return required;
+}
+
 bool CLMem::GetMapWritebackLayoutForImage(void* ptr, size_t* origin,
                                           size_t* region) {
   bool required = false;
@@ -422,11 +976,67 @@ bool CLMem::GetMapWritebackLayoutForImage(void* ptr, size_t* origin,
 }
 
 void CLMem::Unmap(void* ptr) {
-  if (!use_host_)
+  CLDevice* device = NULL;
+  pthread_mutex_lock(&mutex_map_);
+  map<void*, CLDevice*>::iterator it = map_device_.find(ptr);
+  if (it != map_device_.end()) {
+    device = it->second;
+    map_device_.erase(it);
+  }
+  pthread_mutex_unlock(&mutex_map_);
+
+  if (device != NULL)
+    device->FreeMapPtr(ptr);
+  else if (!use_host_)
     free(ptr);
   Release();
 }
 
+cl_int CLMem::Grow(size_t size) {
+  if (!growable_)
+    return CL_INVALID_MEM_OBJECT;
+  if (size > capacity_)
+    return CL_INVALID_BUFFER_SIZE;
+
+  pthread_mutex_lock(&mutex_dev_latest_);
+  if (size < size_) {
+    pthread_mutex_unlock(&mutex_dev_latest_);
+    return CL_INVALID_BUFFER_SIZE;
+  }
+  if (size > size_) {
+    // The committed range has never been written anywhere
+    size_t old_size = size_;
+    if (!latest_.empty())
+      latest_[old_size] = 0;
+    size_ = size;
+    if (!latest_.empty())
+      MergeLatest(old_size, size);
+  }
+  pthread_mutex_unlock(&mutex_dev_latest_);
+  return CL_SUCCESS;
+}
+
+void CLMem::DiscardContents() {
+  pthread_mutex_lock(&mutex_dev_latest_);
+  latest_.clear();
+  latest_mask_ = 0;
+  pthread_mutex_unlock(&mutex_dev_latest_);
+}
+
+cl_int CLMem::Recycle(size_t size) {
+  if (!growable_)
+    return CL_INVALID_MEM_OBJECT;
+  if (size > capacity_)
+    return CL_INVALID_BUFFER_SIZE;
+
+  pthread_mutex_lock(&mutex_dev_latest_);
+  size_ = size;
+  latest_.clear();
+  latest_mask_ = 0;
+  pthread_mutex_unlock(&mutex_dev_latest_);
+  return CL_SUCCESS;
+}
+
 void CLMem::AddDestructorCallback(MemObjectDestructorCallback* callback) {
   pthread_mutex_lock(&mutex_callbacks_);
   callbacks_.push_back(callback);
@@ -455,10 +1065,45 @@ void CLMem::SetHostPtr(void* host_ptr) {
   }
 }
 
+// Writes the initial contents of a COPY_HOST_PTR buffer from the user memory
+// to the device, so that no host copy is made. The transfer is serialized
+// with the other DMA of the device, and no command can refer to the new
+// object yet.
+void CLMem::UploadHostPtr(CLDevice* device, void* host_ptr) {
+  BeginUse();
+  device->WriteBuffer(NULL, this, 0, size_, host_ptr);
+  SetLatest(device);
+  EndUse();
+}
+
+// With several devices, the initial contents are written to the device that
+// uses the buffer first, by the regular write command that LocateMem
+// enqueues. The host copy is dropped once that device holds the contents.
+void CLMem::ReleaseUploadShadow() {
+  if (ReleaseHostCache())
+    upload_shadow_ = false;
+}
+
+void CLMem::TrackHostWrites() {
+  CLDirtyTracker* tracker = CLDirtyTracker::GetTracker();
+  if (!tracker->enabled())
+    return;
+  size_t page_size = tracker->page_size();
+  size_t begin = ((size_t)host_ptr_ + page_size - 1) & ~(page_size - 1);
+  size_t end = ((size_t)host_ptr_ + size_) & ~(page_size - 1);
+  if (begin >= end)
+    return;
+  track_slot_ = tracker->Register((void*)begin, end - begin);
+  if (track_slot_ != -1) {
+    track_begin_ = begin - (size_t)host_ptr_;
+    track_end_ = end - (size_t)host_ptr_;
+  }
+}
+
 CLMem* CLMem::CreateBuffer(CLContext* context, cl_mem_flags flags, size_t size,
                            void* host_ptr, cl_int* err) {
   if (!(flags & (CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY)))
-    flags |= flags & CL_MEM_READ_WRITE;
+    flags |= CL_MEM_READ_WRITE;
 
   CLMem* mem = new CLMem(context);
   if (mem == NULL) {
@@ -469,7 +1114,28 @@ CLMem* CLMem::CreateBuffer(CLContext* context, cl_mem_flags flags, size_t size,
   mem->flags_ = flags;
   mem->size_ = size;
   mem->offset_ = 0;
-  mem->SetHostPtr(host_ptr);
+  bool upload = ((flags & CL_MEM_COPY_HOST_PTR) &&
+                 !(flags & CL_MEM_ALLOC_HOST_PTR));
+  if (upload && context->devices().size() == 1) {
+    mem->UploadHostPtr(context->devices().front(), host_ptr);
+  } else {
+    mem->SetHostPtr(host_ptr);
+    if (upload)
+      mem->upload_shadow_ = true;
+  }
+  if (mem->use_host_)
+    mem->TrackHostWrites();
+  return mem;
+}
+
+CLMem* CLMem::CreateGrowableBuffer(CLContext* context, cl_mem_flags flags,
+                                   size_t size, size_t capacity,
+                                   cl_int* err) {
+  CLMem* mem = CreateBuffer(context, flags, size, NULL, err);
+  if (mem == NULL)
+    return NULL;
+  mem->capacity_ = capacity;
+  mem->growable_ = true;
   return mem;
 }
 
@@ -488,8 +1154,12 @@ CLMem* CLMem::CreateSubBuffer(CLMem* parent, cl_mem_flags flags, size_t origin,
   mem->size_ = size;
   mem->parent_ = parent;
   mem->offset_ = origin;
+  // The parent keeps its host shadow while it has sub-buffers
+  pthread_mutex_lock(&parent->mutex_host_ptr_);
+  __sync_fetch_and_add(&parent->num_children_, 1);
   mem->host_ptr_ = (parent->host_ptr_ == NULL ? NULL :
                     (void*)((size_t)parent->host_ptr_ + origin));
+  pthread_mutex_unlock(&parent->mutex_host_ptr_);
   mem->alloc_host_ = false;
   mem->use_host_ = parent->use_host_;
 
@@ -501,7 +1171,7 @@ CLMem* CLMem::CreateImage(CLContext* context, cl_mem_flags flags,
                           const cl_image_desc* image_desc, void* host_ptr,
                           cl_int* err) {
   if (!(flags & (CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY)))
-    flags |= flags & CL_MEM_READ_WRITE;
+    flags |= CL_MEM_READ_WRITE;
 
   size_t width = image_desc->image_width;
   size_t height = image_desc->image_height;
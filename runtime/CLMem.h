@@ -42,25 +42,46 @@
 #ifndef __SNUCL__CL_MEM_H
 #define __SNUCL__CL_MEM_H
 
+#include <list>
 #include <map>
 #include <set>
 #include <vector>
 #include <pthread.h>
+#include <stdint.h>
 #include <CL/cl.h>
+#include "CLDevice.h"
 #include "CLObject.h"
 #include "Structs.h"
 
 #define LATEST_HOST ((CLDevice*)1)
+// Set in the latest mask of a root buffer whose segments differ
+#define LATEST_SEGMENTED ((uint64_t)1 << 63)
 
 class CLContext;
 class CLDevice;
+class CLEvent;
 class MemObjectDestructorCallback;
 
 typedef struct _CLMapWritebackLayout {
   size_t origin[3];
   size_t region[3];
+  cl_map_flags map_flags;
 } CLMapWritebackLayout;
 
+// A part of a memory object and the device that has its latest contents
+typedef struct _CLMemRange {
+  size_t offset;
+  size_t size;
+  CLDevice* source;
+} CLMemRange;
+
+typedef struct _CLPendingTransfer {
+  CLDevice* device;
+  size_t offset; // from the start of the root buffer
+  size_t size;
+  CLEvent* event;
+} CLPendingTransfer;
+
 class CLMem: public CLObject<struct _cl_mem, CLMem> {
  private:
   CLMem(CLContext* context);
@@ -73,6 +94,8 @@ class CLMem: public CLObject<struct _cl_mem, CLMem> {
   cl_mem_object_type type() const { return type_; }
   cl_mem_flags flags() const { return flags_; }
   size_t size() const { return size_; }
+  // The reserved size of a growable buffer, otherwise the size
+  size_t capacity() const { return (growable_ ? capacity_ : size_); }
   CLMem* parent() const { return parent_; }
   size_t offset() const { return offset_; }
 
@@ -94,6 +117,7 @@ class CLMem: public CLObject<struct _cl_mem, CLMem> {
   bool IsBuffer() const { return type_ == CL_MEM_OBJECT_BUFFER; }
   bool IsImage() const { return type_ != CL_MEM_OBJECT_BUFFER; }
   bool IsSubBuffer() const { return parent_ != NULL; }
+  bool IsGrowable() const { return growable_; }
   bool IsWithinRange(size_t offset, size_t cb) const;
   bool IsWritable() const;
   bool IsHostReadable() const;
@@ -107,37 +131,102 @@ class CLMem: public CLObject<struct _cl_mem, CLMem> {
 
   void* GetHostPtr() const;
   void AllocHostPtr();
+  bool IsUseHostPtr() const { return use_host_; }
+
+  // Writes of the application to the host memory of a USE_HOST_PTR buffer.
+  // Only the pages found dirty are marked as host-latest if they are tracked.
+  void SyncHostWrites();
+  void MarkHostWritten(size_t offset, size_t size);
+
+  // A host shadow charged to the read cache is freed again when the cache
+  // runs out of room, unless the host holds the only copy of some range
+  bool AcquireHostCache();
+  void TouchHostCache();
+  bool ReleaseHostCache();
 
   bool HasDevSpecific(CLDevice* device);
   void* GetDevSpecific(CLDevice* device);
+  void EvictDevSpecific(CLDevice* device);
+  void RelocateDevSpecific(CLDevice* device, void* dev_specific);
+  bool IsEvictedFrom(CLDevice* device);
+  int GetMemBank();
 
+  // A memory object cannot be evicted while commands are using it
+  void BeginUse();
+  void EndUse();
+  bool IsUsedByOthers();
+  bool TryBeginEvict();
+  void EndEvict();
+
+  // The latest copies are tracked per range of the root buffer, so that a
+  // sub-buffer and its parent see each other's writes. Offsets are relative
+  // to this memory object.
   bool EmptyLatest();
   bool HasLatest(CLDevice* device);
+  bool HasLatest(CLDevice* device, size_t offset, size_t size);
   CLDevice* FrontLatest();
   void AddLatest(CLDevice* device);
+  void AddLatest(CLDevice* device, size_t offset, size_t size);
+  void AddLatest(const std::vector<CLDevice*>& devices, size_t offset,
+                 size_t size);
   void SetLatest(CLDevice* device);
-  CLDevice* GetNearestLatest(CLDevice* device);
+  void SetLatest(CLDevice* device, size_t offset, size_t size);
+  void RemoveLatest(CLDevice* device);
+  void GetMissingRanges(CLDevice* device, std::vector<CLMemRange>& ranges);
+  void GetExclusiveRanges(CLDevice* device, std::vector<CLMemRange>& ranges);
+
+  // Copies of the latest contents that are still being transferred
+  void SetPendingEvent(CLDevice* device, size_t offset, size_t size,
+                       CLEvent* event);
+  void GetPendingEvents(CLDevice* device, size_t offset, size_t size,
+                        std::vector<CLEvent*>& events);
 
-  void* MapAsBuffer(cl_map_flags map_flags, size_t offset, size_t size);
+  void* MapAsBuffer(CLDevice* device, cl_map_flags map_flags, size_t offset,
+                    size_t size);
   void* MapAsImage(cl_map_flags map_flags, const size_t* origin,
                    const size_t* region, size_t* image_row_pitch,
                    size_t* image_slice_pitch);
   bool IsMapInitRequired(void* ptr);
+  bool IsMapWritebackAll(void* ptr);
   bool GetMapWritebackLayoutForBuffer(void* ptr, size_t* offset, size_t* size);
+  bool PeekMapWritebackLayoutForBuffer(void* ptr, size_t* offset,
+                                       size_t* size);
   bool GetMapWritebackLayoutForImage(void* ptr, size_t* origin,
                                      size_t* region);
   void Unmap(void* ptr);
 
   void AddDestructorCallback(MemObjectDestructorCallback* callback);
 
+  // Commits more of the reserved range without moving the contents
+  cl_int Grow(size_t size);
+  // Drops the contents of a pooled buffer that is handed out again
+  void DiscardContents();
+  cl_int Recycle(size_t size);
+
  private:
+  // Bit i of a latest mask is the device with index i, and bit 0 is the host
+  typedef std::map<size_t, uint64_t> LatestMap;
+
   void SetHostPtr(void* host_ptr);
+  void UploadHostPtr(CLDevice* device, void* host_ptr);
+  void ReleaseUploadShadow();
+  void TrackHostWrites();
+  CLMem* GetRoot() { return (parent_ != NULL ? parent_ : this); }
+  void AddLatestMask(uint64_t mask, size_t offset, size_t size);
+  LatestMap::iterator SplitLatest(size_t offset);
+  void MergeLatest(size_t begin, size_t end);
+  LatestMap::iterator FindLatest(size_t offset);
+  CLDevice* GetNearestLatest(CLDevice* device, uint64_t mask);
+  static uint64_t GetLatestBit(CLDevice* device);
+  static CLDevice* GetLatestDevice(int index);
 
  private:
   CLContext* context_;
   cl_mem_object_type type_;
   cl_mem_flags flags_;
   size_t size_;
+  size_t capacity_;
+  bool growable_;
 
   CLMem* parent_;
   size_t offset_;
@@ -145,6 +234,15 @@ class CLMem: public CLObject<struct _cl_mem, CLMem> {
   void* host_ptr_;
   bool alloc_host_;
   bool use_host_;
+  bool host_cached_; // host_ptr_ is charged to the read cache
+  // host_ptr_ holds initial contents that no device has received yet
+  volatile bool upload_shadow_;
+  int num_children_;
+  // Slot in the dirty tracker, or -1. Only whole pages between
+  // host_ptr_ + track_begin_ and host_ptr_ + track_end_ are tracked.
+  int track_slot_;
+  size_t track_begin_;
+  size_t track_end_;
 
   cl_image_format image_format_;
   cl_image_desc image_desc_;
@@ -154,14 +252,25 @@ class CLMem: public CLObject<struct _cl_mem, CLMem> {
   size_t image_slice_pitch_;
   size_t image_region_[3];
 
-  std::map<CLDevice*, void*> dev_specific_;
-  std::set<CLDevice*> dev_latest_;
+  void* dev_specific_[MAX_NUM_DEVICES]; // valid if set in dev_alloc_mask_
+  volatile uint64_t dev_alloc_mask_;
+  volatile uint64_t dev_evicted_mask_;
+  uint64_t dev_allocating_mask_; // guarded by mutex_dev_specific_
+  // Used by the root only. latest_mask_ mirrors latest_ so that checks on an
+  // unsegmented buffer do not take the lock.
+  LatestMap latest_; // segment offset -> latest mask
+  volatile uint64_t latest_mask_;
+  std::list<CLPendingTransfer> pending_;
+  volatile size_t num_pending_;
+  int in_use_; // -1 while being evicted
   std::vector<MemObjectDestructorCallback*> callbacks_;
 
   cl_uint map_count_;
   std::map<void*, CLMapWritebackLayout> map_writeback_;
+  std::map<void*, CLDevice*> map_device_;
 
   pthread_mutex_t mutex_dev_specific_;
+  pthread_cond_t cond_dev_specific_;
   pthread_mutex_t mutex_dev_latest_;
   pthread_mutex_t mutex_host_ptr_;
   pthread_mutex_t mutex_map_;
@@ -170,6 +279,9 @@ class CLMem: public CLObject<struct _cl_mem, CLMem> {
  public:
   static CLMem* CreateBuffer(CLContext* context, cl_mem_flags flags,
                              size_t size, void* host_ptr, cl_int* err);
+  static CLMem* CreateGrowableBuffer(CLContext* context, cl_mem_flags flags,
+                                     size_t size, size_t capacity,
+                                     cl_int* err);
   static CLMem* CreateSubBuffer(CLMem* parent, cl_mem_flags flags,
                                 size_t origin, size_t size, cl_int* err);
   static CLMem* CreateImage(CLContext* context, cl_mem_flags flags,
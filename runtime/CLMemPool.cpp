@@ -0,0 +1,200 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#include "CLMemPool.h"
+#include <map>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <stdlib.h>
+#include <CL/cl.h>
+#include "CLCommandQueue.h"
+#include "CLContext.h"
+#include "CLEvent.h"
+#include "CLMem.h"
+
+using namespace std;
+
+// 64 MB unless overridden by SNUCL_MEM_POOL_THRESHOLD (in bytes)
+#define MEM_POOL_DEFAULT_THRESHOLD (64UL << 20)
+// Buffers are reserved in multiples of this size so that they can be reused
+// for slightly larger requests
+#define MEM_POOL_GRANULARITY (64UL << 10)
+
+CLMemPool::CLMemPool() {
+  threshold_ = MEM_POOL_DEFAULT_THRESHOLD;
+  char* threshold = getenv("SNUCL_MEM_POOL_THRESHOLD");
+  if (threshold != NULL)
+    threshold_ = strtoul(threshold, NULL, 0);
+  used_bytes_ = 0;
+  cached_bytes_ = 0;
+  num_allocs_ = 0;
+  num_reuses_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+CLMemPool::~CLMemPool() {
+  vector<CLFreeBlock> blocks;
+  for (multimap<size_t, CLFreeBlock>::iterator it = free_blocks_.begin();
+       it != free_blocks_.end();
+       ++it) {
+    blocks.push_back(it->second);
+  }
+  free_blocks_.clear();
+  ReleaseBlocks(blocks);
+  pthread_mutex_destroy(&mutex_);
+}
+
+CLMem* CLMemPool::Alloc(CLCommandQueue* queue, cl_mem_flags flags,
+                        size_t size, cl_int* err) {
+  if (!(flags & (CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY)))
+    flags |= CL_MEM_READ_WRITE;
+
+  CLMem* mem = NULL;
+  CLEvent* event = NULL;
+  CLCommandQueue* free_queue = NULL;
+  pthread_mutex_lock(&mutex_);
+  // Best fit, wasting at most half of the block
+  for (multimap<size_t, CLFreeBlock>::iterator it =
+           free_blocks_.lower_bound(size);
+       it != free_blocks_.end() && it->first / 2 <= size;
+       ++it) {
+    CLFreeBlock& block = it->second;
+    if (block.mem->context() != queue->context() ||
+        block.mem->flags() != flags)
+      continue;
+    // Commands ahead of the free in the same in-order queue may still look
+    // at the old size, so only a block of the same size is taken early. Its
+    // contents are dropped when the allocation command is resolved.
+    if (!block.event->IsComplete() &&
+        !(block.queue == queue && queue->IsInOrder() &&
+          block.mem->size() == size))
+      continue;
+    mem = block.mem;
+    event = block.event;
+    free_queue = block.queue;
+    cached_bytes_ -= it->first;
+    free_blocks_.erase(it);
+    break;
+  }
+  if (mem != NULL) {
+    used_bytes_ += mem->capacity();
+    used_mems_.insert(mem);
+    num_reuses_++;
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  if (mem != NULL) {
+    event->Release();
+    free_queue->Release();
+    if (mem->size() != size)
+      mem->Recycle(size);
+    return mem;
+  }
+
+  size_t capacity = (size + MEM_POOL_GRANULARITY - 1) &
+                    ~(MEM_POOL_GRANULARITY - 1);
+  mem = CLMem::CreateGrowableBuffer(queue->context(), flags, size, capacity,
+                                    err);
+  if (mem == NULL)
+    return NULL;
+  pthread_mutex_lock(&mutex_);
+  used_bytes_ += capacity;
+  used_mems_.insert(mem);
+  num_allocs_++;
+  pthread_mutex_unlock(&mutex_);
+  return mem;
+}
+
+bool CLMemPool::IsAllocated(CLMem* mem) {
+  pthread_mutex_lock(&mutex_);
+  bool allocated = (used_mems_.count(mem) > 0);
+  pthread_mutex_unlock(&mutex_);
+  return allocated;
+}
+
+void CLMemPool::Free(CLCommandQueue* queue, CLMem* mem, CLEvent* event) {
+  vector<CLFreeBlock> victims;
+  pthread_mutex_lock(&mutex_);
+  if (used_mems_.erase(mem) == 0) {
+    // Freed twice
+    pthread_mutex_unlock(&mutex_);
+    return;
+  }
+  queue->Retain();
+  event->Retain();
+  CLFreeBlock block = {mem, queue, event};
+  free_blocks_.insert(make_pair(mem->capacity(), block));
+  used_bytes_ -= mem->capacity();
+  cached_bytes_ += mem->capacity();
+  Trim(victims);
+  pthread_mutex_unlock(&mutex_);
+  ReleaseBlocks(victims);
+}
+
+void CLMemPool::SetThreshold(size_t threshold) {
+  vector<CLFreeBlock> victims;
+  pthread_mutex_lock(&mutex_);
+  threshold_ = threshold;
+  Trim(victims);
+  pthread_mutex_unlock(&mutex_);
+  ReleaseBlocks(victims);
+}
+
+// Called with mutex_ held. Gives up the largest blocks first. A block whose
+// free command is still pending is kept alive by that command.
+void CLMemPool::Trim(vector<CLFreeBlock>& victims) {
+  while (cached_bytes_ > threshold_ && !free_blocks_.empty()) {
+    multimap<size_t, CLFreeBlock>::iterator it = --free_blocks_.end();
+    victims.push_back(it->second);
+    cached_bytes_ -= it->first;
+    free_blocks_.erase(it);
+  }
+}
+
+void CLMemPool::ReleaseBlocks(vector<CLFreeBlock>& blocks) {
+  for (vector<CLFreeBlock>::iterator it = blocks.begin();
+       it != blocks.end();
+       ++it) {
+    it->event->Release();
+    it->queue->Release();
+    it->mem->Release();
+  }
+}
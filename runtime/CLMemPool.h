@@ -0,0 +1,98 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SNUCL__CL_MEM_POOL_H
+#define __SNUCL__CL_MEM_POOL_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <CL/cl.h>
+
+class CLCommandQueue;
+class CLEvent;
+class CLMem;
+
+// Buffers allocated and freed in queue order by clEnqueueAllocBuffer and
+// clEnqueueFreeBuffer. A freed buffer keeps its device memory and is handed
+// out again once its free command completes, or right away to a later
+// allocation in the same in-order queue. Free buffers beyond the release
+// threshold are destroyed.
+class CLMemPool {
+ public:
+  CLMemPool();
+  ~CLMemPool();
+
+  size_t threshold() const { return threshold_; }
+  size_t used_bytes() const { return used_bytes_; }
+  size_t cached_bytes() const { return cached_bytes_; }
+  cl_ulong num_allocs() const { return num_allocs_; }
+  cl_ulong num_reuses() const { return num_reuses_; }
+
+  CLMem* Alloc(CLCommandQueue* queue, cl_mem_flags flags, size_t size,
+               cl_int* err);
+  bool IsAllocated(CLMem* mem);
+  // Takes over the reference of the application
+  void Free(CLCommandQueue* queue, CLMem* mem, CLEvent* event);
+  void SetThreshold(size_t threshold);
+
+ private:
+  typedef struct _CLFreeBlock {
+    CLMem* mem;
+    CLCommandQueue* queue; // that freed the block
+    CLEvent* event; // of the free command
+  } CLFreeBlock;
+
+  void Trim(std::vector<CLFreeBlock>& victims);
+  static void ReleaseBlocks(std::vector<CLFreeBlock>& blocks);
+
+  size_t threshold_;
+  size_t used_bytes_;
+  size_t cached_bytes_;
+  cl_ulong num_allocs_;
+  cl_ulong num_reuses_;
+  std::multimap<size_t, CLFreeBlock> free_blocks_; // capacity -> block
+  std::set<CLMem*> used_mems_;
+
+  pthread_mutex_t mutex_;
+};
+
+#endif // __SNUCL__CL_MEM_POOL_H
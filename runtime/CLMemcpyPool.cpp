@@ -0,0 +1,271 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#include "CLMemcpyPool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "CLDirtyTracker.h"
+#include "Utils.h"
+
+using namespace std;
+
+// Overridden by SNUCL_MEMCPY_THREADS (0 disables the pool)
+#define MEMCPY_DEFAULT_THREADS 4
+// Smaller copies are done by the caller alone. Overridden by
+// SNUCL_MEMCPY_THRESHOLD (in bytes).
+#define MEMCPY_DEFAULT_THRESHOLD (2UL << 20)
+#define MEMCPY_TASK_SIZE (256UL << 10)
+
+typedef struct _CLMemcpyTask {
+  char* dst;
+  const char* src;
+  size_t size;
+  bool non_temporal;
+} CLMemcpyTask;
+
+static void CopyStreaming(char* dst, const char* src, size_t size) {
+#ifdef __SSE2__
+  size_t head = (16 - (uintptr_t)dst % 16) % 16;
+  if (head > size) head = size;
+  memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+  size_t num_vectors = size / 16;
+  for (size_t i = 0; i < num_vectors; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i*)src + i);
+    _mm_stream_si128((__m128i*)dst + i, v);
+  }
+  _mm_sfence();
+  memcpy(dst + num_vectors * 16, src + num_vectors * 16, size % 16);
+#else
+  memcpy(dst, src, size);
+#endif
+}
+
+static void CopyTask(size_t i, void* data) {
+  CLMemcpyTask* task = (CLMemcpyTask*)data;
+  size_t offset = i * MEMCPY_TASK_SIZE;
+  size_t size = task->size - offset;
+  if (size > MEMCPY_TASK_SIZE) size = MEMCPY_TASK_SIZE;
+  if (task->non_temporal)
+    CopyStreaming(task->dst + offset, task->src + offset, size);
+  else
+    memcpy(task->dst + offset, task->src + offset, size);
+}
+
+CLMemcpyPool::CLMemcpyPool() {
+  threshold_ = MEMCPY_DEFAULT_THRESHOLD;
+  char* threshold = getenv("SNUCL_MEMCPY_THRESHOLD");
+  if (threshold != NULL)
+    threshold_ = strtoul(threshold, NULL, 0);
+  int num_threads = MEMCPY_DEFAULT_THREADS;
+  char* threads = getenv("SNUCL_MEMCPY_THREADS");
+  if (threads != NULL)
+    num_threads = atoi(threads);
+
+  quit_ = false;
+  func_ = NULL;
+  data_ = NULL;
+  num_tasks_ = 0;
+  next_task_ = 0;
+  num_done_ = 0;
+  generation_ = 0;
+  pthread_mutex_init(&mutex_job_, NULL);
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&cond_start_, NULL);
+  pthread_cond_init(&cond_done_, NULL);
+
+  cpu_set_t cpus;
+  bool local = GetLocalCPUs(&cpus);
+  for (int i = 0; i < num_threads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ThreadFunc, this) != 0)
+      break;
+    if (local)
+      pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus);
+    threads_.push_back(thread);
+  }
+}
+
+CLMemcpyPool::~CLMemcpyPool() {
+  pthread_mutex_lock(&mutex_);
+  quit_ = true;
+  pthread_cond_broadcast(&cond_start_);
+  pthread_mutex_unlock(&mutex_);
+  for (size_t i = 0; i < threads_.size(); i++)
+    pthread_join(threads_[i], NULL);
+  pthread_mutex_destroy(&mutex_job_);
+  pthread_mutex_destroy(&mutex_);
+  pthread_cond_destroy(&cond_start_);
+  pthread_cond_destroy(&cond_done_);
+}
+
+void CLMemcpyPool::Copy(void* dst, const void* src, size_t size,
+                        bool non_temporal) {
+  if (size < threshold_ || threads_.empty()) {
+    memcpy(dst, src, size);
+    return;
+  }
+  CLMemcpyTask task = {(char*)dst, (const char*)src, size, non_temporal};
+  ParallelFor((size + MEMCPY_TASK_SIZE - 1) / MEMCPY_TASK_SIZE, CopyTask,
+              &task);
+}
+
+void CLMemcpyPool::ParallelFor(size_t n, void (*func)(size_t, void*),
+                               void* data) {
+  if (threads_.empty() || pthread_mutex_trylock(&mutex_job_) != 0) {
+    for (size_t i = 0; i < n; i++)
+      func(i, data);
+    return;
+  }
+
+  pthread_mutex_lock(&mutex_);
+  func_ = func;
+  data_ = data;
+  num_tasks_ = n;
+  next_task_ = 0;
+  num_done_ = 0;
+  generation_++;
+  pthread_cond_broadcast(&cond_start_);
+  pthread_mutex_unlock(&mutex_);
+
+  RunTasks();
+
+  pthread_mutex_lock(&mutex_);
+  while (num_done_ < num_tasks_)
+    pthread_cond_wait(&cond_done_, &mutex_);
+  func_ = NULL;
+  pthread_mutex_unlock(&mutex_);
+  pthread_mutex_unlock(&mutex_job_);
+}
+
+void* CLMemcpyPool::ThreadFunc(void* argp) {
+  ((CLMemcpyPool*)argp)->RunWorker();
+  return NULL;
+}
+
+void CLMemcpyPool::RunWorker() {
+  // Copies into tracked host memory are not the application's writes
+  CLDirtyTracker::EnterRuntimeThread();
+  unsigned long generation = 0;
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    while (!quit_ && (func_ == NULL || generation_ == generation))
+      pthread_cond_wait(&cond_start_, &mutex_);
+    if (quit_)
+      break;
+    generation = generation_;
+    pthread_mutex_unlock(&mutex_);
+    RunTasks();
+    pthread_mutex_lock(&mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Tasks are handed out one at a time so that slow threads take fewer
+void CLMemcpyPool::RunTasks() {
+  pthread_mutex_lock(&mutex_);
+  while (func_ != NULL && next_task_ < num_tasks_) {
+    size_t i = next_task_++;
+    void (*func)(size_t, void*) = func_;
+    void* data = data_;
+    pthread_mutex_unlock(&mutex_);
+    func(i, data);
+    // Before the caller sees the task done and the application may write
+    CLDirtyTracker::ReprotectRuntimePages();
+    pthread_mutex_lock(&mutex_);
+    if (++num_done_ == num_tasks_)
+      pthread_cond_signal(&cond_done_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Returns the CPUs of the NUMA node that the calling thread runs on
+bool CLMemcpyPool::GetLocalCPUs(cpu_set_t* cpus) {
+  int cpu = sched_getcpu();
+  if (cpu < 0)
+    return false;
+  for (int node = 0; ; node++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+      return false;
+    CPU_ZERO(cpus);
+    bool found = false;
+    int first, last;
+    while (fscanf(fp, "%d", &first) == 1) {
+      last = first;
+      int c = fgetc(fp);
+      if (c == '-') {
+        if (fscanf(fp, "%d", &last) != 1)
+          break;
+        c = fgetc(fp);
+      }
+      for (int i = first; i <= last && i < CPU_SETSIZE; i++)
+        CPU_SET(i, cpus);
+      if (first <= cpu && cpu <= last)
+        found = true;
+      if (c != ',')
+        break;
+    }
+    fclose(fp);
+    if (found)
+      return true;
+  }
+}
+
+CLMemcpyPool* CLMemcpyPool::singleton_ = NULL;
+
+CLMemcpyPool* CLMemcpyPool::GetPool() {
+  if (singleton_ == NULL)
+    singleton_ = new CLMemcpyPool();
+  return singleton_;
+}
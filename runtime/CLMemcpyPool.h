@@ -0,0 +1,99 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SNUCL__CL_MEMCPY_POOL_H
+#define __SNUCL__CL_MEMCPY_POOL_H
+
+#include <vector>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Worker threads that split large host copies, e.g. between user memory and
+// a DMA staging buffer. The workers run on the NUMA node of the thread that
+// creates the pool, which is also where the staging buffers are allocated.
+class CLMemcpyPool {
+ private:
+  CLMemcpyPool();
+
+ public:
+  ~CLMemcpyPool();
+
+  size_t threshold() const { return threshold_; }
+
+  // Non-temporal stores bypass the cache, for destinations that the host
+  // does not read again soon
+  void Copy(void* dst, const void* src, size_t size,
+            bool non_temporal = false);
+  // Calls func(i, data) for every i in [0, n) on the workers and the
+  // calling thread
+  void ParallelFor(size_t n, void (*func)(size_t, void*), void* data);
+
+ private:
+  static void* ThreadFunc(void* argp);
+  void RunWorker();
+  void RunTasks();
+  static bool GetLocalCPUs(cpu_set_t* cpus);
+
+  size_t threshold_;
+  std::vector<pthread_t> threads_;
+  bool quit_;
+
+  // The current job. Only one caller uses the workers at a time; the others
+  // copy by themselves.
+  void (*func_)(size_t, void*);
+  void* data_;
+  size_t num_tasks_;
+  size_t next_task_;
+  size_t num_done_;
+  unsigned long generation_;
+  pthread_mutex_t mutex_job_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_start_;
+  pthread_cond_t cond_done_;
+
+ public:
+  static CLMemcpyPool* GetPool();
+
+ private:
+  static CLMemcpyPool* singleton_;
+};
+
+#endif // __SNUCL__CL_MEMCPY_POOL_H
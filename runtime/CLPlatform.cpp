@@ -41,6 +41,7 @@
 
 #include "CLPlatform.h"
 #include <algorithm>
+#include <cstdlib>
 #include <vector>
 #include <pthread.h>
 #include <CL/cl.h>
@@ -48,9 +49,12 @@
 #include "Callbacks.h"
 #include "CLContext.h"
 #include "CLDevice.h"
+#include "CLDirtyTracker.h"
 #include "CLDispatch.h"
 #include "CLIssuer.h"
+#include "CLMemcpyPool.h"
 #include "CLObject.h"
+#include "CLReadCache.h"
 #include "CLScheduler.h"
 #include "Structs.h"
 #include "Utils.h"
@@ -69,6 +73,9 @@ CLPlatform::CLPlatform() {
   extensions_ = "";
   suffix_ = "SnuCL";
   default_device_type_ = CL_DEVICE_TYPE_ACCELERATOR;
+  for (int i = 0; i < MAX_NUM_DEVICES; i++)
+    device_table_[i] = NULL;
+  next_device_index_ = 1;
   pthread_mutex_init(&mutex_devices_, NULL);
   pthread_mutex_init(&mutex_issuers_, NULL);
 }
@@ -95,6 +102,9 @@ CLPlatform::~CLPlatform() {
 
 void CLPlatform::Init() {
   InitSchedulers(1, false);
+  CLReadCache::GetCache();
+  CLDirtyTracker::GetTracker();
+  CLMemcpyPool::GetPool();
 
 #ifdef OPAE_PLATFORM
   OPAEDevice::CreateDevices();
@@ -296,14 +306,25 @@ CLDevice* CLPlatform::GetFirstDevice() {
 
 void CLPlatform::AddDevice(CLDevice* device) {
   pthread_mutex_lock(&mutex_devices_);
+  if (next_device_index_ >= MAX_NUM_DEVICES) {
+    SNUCL_ERROR("Too many devices (max %d)", MAX_NUM_DEVICES - 1);
+    exit(EXIT_FAILURE);
+  }
+  device->set_index(next_device_index_);
+  device_table_[next_device_index_++] = device;
   devices_.push_back(device);
   pthread_mutex_unlock(&mutex_devices_);
   AddIssuer(new CLIssuer(device, true));
 }
 
+void CLPlatform::AddCopyLane(CLDevice* device) {
+  AddIssuer(new CLIssuer(device, true, true));
+}
+
 void CLPlatform::RemoveDevice(CLDevice* device) {
   RemoveIssuerOfDevice(device);
   pthread_mutex_lock(&mutex_devices_);
+  device_table_[device->index()] = NULL;
   devices_.erase(remove(devices_.begin(), devices_.end(), device),
                  devices_.end());
   pthread_mutex_unlock(&mutex_devices_);
@@ -376,20 +397,21 @@ void CLPlatform::AddIssuer(CLIssuer* issuer) {
 }
 
 void CLPlatform::RemoveIssuerOfDevice(CLDevice* device) {
+  // A device may have a second issuer for its copy lane
+  vector<CLIssuer*> removed;
   pthread_mutex_lock(&mutex_issuers_);
-  CLIssuer* issuer = NULL;
-  for (vector<CLIssuer*>::iterator it = issuers_.begin();
-       it != issuers_.end();
-       ++it) {
+  vector<CLIssuer*>::iterator it = issuers_.begin();
+  while (it != issuers_.end()) {
     if ((*it)->GetFirstDevice() == device) {
-      issuer = *it;
-      issuers_.erase(it);
-      break;
+      removed.push_back(*it);
+      it = issuers_.erase(it);
+    } else {
+      ++it;
     }
   }
   pthread_mutex_unlock(&mutex_issuers_);
-  if (issuer != NULL)
-    delete issuer;
+  for (it = removed.begin(); it != removed.end(); ++it)
+    delete (*it);
 }
 
 void CLPlatform::AddDeviceToFirstIssuer(CLDevice* device) {
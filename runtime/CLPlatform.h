@@ -45,6 +45,7 @@
 #include <vector>
 #include <pthread.h>
 #include <CL/cl.h>
+#include "CLDevice.h"
 #include "CLObject.h"
 #include "Structs.h"
 
@@ -76,7 +77,9 @@ class CLPlatform: public CLObject<struct _cl_platform_id, CLPlatform> {
 
   void GetDevices(std::vector<CLDevice*>& devices);
   CLDevice* GetFirstDevice();
+  CLDevice* GetDeviceByIndex(int index) const { return device_table_[index]; }
   void AddDevice(CLDevice* device);
+  void AddCopyLane(CLDevice* device);
   void RemoveDevice(CLDevice* device);
 
   CLScheduler* AllocIdleScheduler();
@@ -104,6 +107,8 @@ class CLPlatform: public CLObject<struct _cl_platform_id, CLPlatform> {
 #endif
 
   std::vector<CLDevice*> devices_;
+  CLDevice* device_table_[MAX_NUM_DEVICES]; // index -> device
+  int next_device_index_;
   std::vector<CLScheduler*> schedulers_;
   std::vector<CLIssuer*> issuers_;
 
@@ -281,6 +281,16 @@ cl_int CLKernelInfo::GetKernelArgInfo(cl_uint arg_index,
   return CL_SUCCESS;
 }
 
+// Returns true if the argument metadata guarantees that the kernel never
+// writes to the memory object bound to the argument
+bool CLKernelInfo::IsArgReadOnly(cl_uint arg_index) const {
+  if (indexes_.count(arg_index) == 0)
+    return false;
+  return arg_address_qualifiers_[arg_index] == CL_KERNEL_ARG_ADDRESS_CONSTANT ||
+         arg_access_qualifiers_[arg_index] == CL_KERNEL_ARG_ACCESS_READ_ONLY ||
+         (arg_type_qualifiers_[arg_index] & CL_KERNEL_ARG_TYPE_CONST);
+}
+
 void CLKernelInfo::Update(const char* name, cl_uint num_args,
                           const char* attributes) {
   if (strcmp(name_, name) != 0 || num_args_ != num_args ||
@@ -132,6 +132,7 @@ class CLKernelInfo {
   cl_int GetKernelArgInfo(cl_uint arg_index, cl_kernel_arg_info param_name,
                           size_t param_value_size, void* param_value,
                           size_t* param_value_size_ret);
+  bool IsArgReadOnly(cl_uint arg_index) const;
 
   bool IsValid() const { return valid_; }
 
@@ -0,0 +1,121 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#include "CLReadCache.h"
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <stdlib.h>
+#include "CLMem.h"
+
+using namespace std;
+
+// 64 MB unless overridden by SNUCL_READ_CACHE_SIZE (in bytes, 0 disables)
+#define READ_CACHE_DEFAULT_SIZE (64UL << 20)
+
+CLReadCache::CLReadCache() {
+  capacity_ = READ_CACHE_DEFAULT_SIZE;
+  char* size = getenv("SNUCL_READ_CACHE_SIZE");
+  if (size != NULL)
+    capacity_ = strtoul(size, NULL, 0);
+  used_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+CLReadCache::~CLReadCache() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+// Charges the host shadow of the memory object to the cache, reclaiming the
+// shadows of other objects if needed
+bool CLReadCache::Admit(CLMem* mem) {
+  size_t size = mem->size();
+  pthread_mutex_lock(&mutex_);
+  if (lru_pos_.count(mem)) {
+    pthread_mutex_unlock(&mutex_);
+    return true;
+  }
+  list<CLMem*>::iterator it = lru_mems_.begin();
+  while (used_ + size > capacity_ && it != lru_mems_.end()) {
+    CLMem* victim = *it;
+    if (victim->ReleaseHostCache()) {
+      used_ -= victim->size();
+      lru_pos_.erase(victim);
+      it = lru_mems_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  bool admitted = (used_ + size <= capacity_);
+  if (admitted) {
+    lru_pos_[mem] = lru_mems_.insert(lru_mems_.end(), mem);
+    used_ += size;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return admitted;
+}
+
+void CLReadCache::Touch(CLMem* mem) {
+  pthread_mutex_lock(&mutex_);
+  map<CLMem*, list<CLMem*>::iterator>::iterator it = lru_pos_.find(mem);
+  if (it != lru_pos_.end())
+    lru_mems_.splice(lru_mems_.end(), lru_mems_, it->second);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void CLReadCache::Remove(CLMem* mem) {
+  pthread_mutex_lock(&mutex_);
+  map<CLMem*, list<CLMem*>::iterator>::iterator it = lru_pos_.find(mem);
+  if (it != lru_pos_.end()) {
+    used_ -= mem->size();
+    lru_mems_.erase(it->second);
+    lru_pos_.erase(it);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+CLReadCache* CLReadCache::singleton_ = NULL;
+
+CLReadCache* CLReadCache::GetCache() {
+  if (singleton_ == NULL)
+    singleton_ = new CLReadCache();
+  return singleton_;
+}
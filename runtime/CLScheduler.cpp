@@ -48,6 +48,7 @@
 #include "CLCommand.h"
 #include "CLCommandQueue.h"
 #include "CLDevice.h"
+#include "CLDirtyTracker.h"
 #include "CLEvent.h"
 #include "CLPlatform.h"
 
@@ -117,6 +118,7 @@ void CLScheduler::RemoveCommandQueue(CLCommandQueue* queue) {
 
 void CLScheduler::Run() {
   vector<CLCommandQueue*> target_queues;
+  CLDirtyTracker::EnterRuntimeThread();
 
   while (thread_running_) {
     if (!busy_waiting_)
@@ -142,6 +144,7 @@ void CLScheduler::Run() {
         command->Submit();
         queue->Dequeue(command);
       }
+      CLDirtyTracker::ReprotectRuntimePages();
     }
   }
 }
@@ -41,6 +41,10 @@
 
 #include "Utils.h"
 #include <stdio.h>
+#include <string.h>
+#include "CLMemcpyPool.h"
+
+#define COPY_REGION_TASK_SIZE (256UL << 10)
 
 LockFreeQueue::LockFreeQueue(unsigned long size) {
   size_ = size;
@@ -76,6 +80,13 @@ bool LockFreeQueue::Peek(CLCommand** element) {
   return true;
 }
 
+// Looks at the index-th element from the head. Only the consumer may call it.
+bool LockFreeQueue::PeekAt(unsigned long index, CLCommand** element) {
+  if (index >= Size()) return false;
+  *element = (CLCommand*) elements_[(idx_r_ + index) % size_];
+  return true;
+}
+
 unsigned long LockFreeQueue::Size() {
   if (idx_w_ >= idx_r_) return idx_w_ - idx_r_;
   return size_ - idx_r_ + idx_w_;
@@ -110,6 +121,32 @@ size_t PipeRead(const char* filename, char* buf, size_t size) {
   return read_size;
 }
 
+typedef struct _CopyRegionRows {
+  char* src;
+  char* dst;
+  size_t row_size;
+  size_t num_rows;
+  size_t rows_per_slice;
+  size_t rows_per_task;
+  size_t src_row_pitch;
+  size_t src_slice_pitch;
+  size_t dst_row_pitch;
+  size_t dst_slice_pitch;
+} CopyRegionRows;
+
+static void CopyRows(size_t task, void* data) {
+  CopyRegionRows* rows = (CopyRegionRows*)data;
+  size_t first = task * rows->rows_per_task;
+  size_t last = first + rows->rows_per_task;
+  if (last > rows->num_rows) last = rows->num_rows;
+  for (size_t i = first; i < last; i++) {
+    size_t z = i / rows->rows_per_slice, y = i % rows->rows_per_slice;
+    memcpy(rows->dst + z * rows->dst_slice_pitch + y * rows->dst_row_pitch,
+           rows->src + z * rows->src_slice_pitch + y * rows->src_row_pitch,
+           rows->row_size);
+  }
+}
+
 void CopyRegion(void* src, void* dst, size_t dimension,
                 const size_t* src_origin, const size_t* dst_origin,
                 const size_t* region, size_t element_size,
@@ -124,28 +161,42 @@ void CopyRegion(void* src, void* dst, size_t dimension,
   if (dst_slice_pitch == 0)
     dst_slice_pitch = region[1] * dst_row_pitch;
 
+  CopyRegionRows rows;
+  rows.src = (char*)src + src_origin[0] * element_size;
+  rows.dst = (char*)dst + dst_origin[0] * element_size;
+  rows.row_size = region[0] * element_size;
+  rows.num_rows = 1;
+  rows.rows_per_slice = 1;
+  if (dimension >= 2 && region[1] > 0) {
+    rows.src += src_origin[1] * src_row_pitch;
+    rows.dst += dst_origin[1] * dst_row_pitch;
+    rows.num_rows = rows.rows_per_slice = region[1];
+  }
   if (dimension >= 3 && region[2] > 0 && region[1] > 0) {
-    size_t sz = src_origin[2], dz = dst_origin[2];
-    for (size_t z = 0; z < region[2]; z++, sz++, dz++) {
-      size_t sy = src_origin[1], dy = dst_origin[1];
-      for (size_t y = 0; y < region[1]; y++, sy++, dy++) {
-        size_t soff = sz * src_slice_pitch + sy * src_row_pitch +
-                      src_origin[0] * element_size;
-        size_t doff = dz * dst_slice_pitch + dy * dst_row_pitch +
-                      dst_origin[0] * element_size;
-        memcpy((char*)dst + doff, (char*)src + soff, region[0] * element_size);
-      }
-    }
-  } else if (dimension >= 2 && region[1] > 0) {
-    size_t sy = src_origin[1], dy = dst_origin[1];
-    for (size_t y = 0; y < region[1]; y++, sy++, dy++) {
-      size_t soff = sy * src_row_pitch + src_origin[0] * element_size;
-      size_t doff = dy * dst_row_pitch + dst_origin[0] * element_size;
-      memcpy((char*)dst + doff, (char*)src + soff, region[0] * element_size);
-    }
-  } else {
-    size_t soff = src_origin[0] * element_size;
-    size_t doff = dst_origin[0] * element_size;
-    memcpy((char*)dst + doff, (char*)src + soff, region[0] * element_size);
+    rows.src += src_origin[2] * src_slice_pitch;
+    rows.dst += dst_origin[2] * dst_slice_pitch;
+    rows.num_rows *= region[2];
+  }
+  rows.src_row_pitch = src_row_pitch;
+  rows.src_slice_pitch = src_slice_pitch;
+  rows.dst_row_pitch = dst_row_pitch;
+  rows.dst_slice_pitch = dst_slice_pitch;
+
+  CLMemcpyPool* pool = CLMemcpyPool::GetPool();
+  if (rows.num_rows == 1) {
+    pool->Copy(rows.dst, rows.src, rows.row_size);
+    return;
+  }
+  size_t total_size = rows.num_rows * rows.row_size;
+  if (total_size < pool->threshold() || rows.row_size == 0) {
+    rows.rows_per_task = rows.num_rows;
+    CopyRows(0, &rows);
+    return;
   }
+  // Each task copies whole rows, about COPY_REGION_TASK_SIZE bytes in total
+  rows.rows_per_task = COPY_REGION_TASK_SIZE / rows.row_size;
+  if (rows.rows_per_task == 0) rows.rows_per_task = 1;
+  pool->ParallelFor(
+      (rows.num_rows + rows.rows_per_task - 1) / rows.rows_per_task,
+      CopyRows, &rows);
 }
@@ -119,6 +119,7 @@ class LockFreeQueue {
   virtual bool Enqueue(CLCommand* element);
   bool Dequeue(CLCommand** element);
   bool Peek(CLCommand** element);
+  bool PeekAt(unsigned long index, CLCommand** element);
   unsigned long Size();
 
 protected:
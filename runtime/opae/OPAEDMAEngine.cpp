@@ -0,0 +1,195 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#include "opae/OPAEDMAEngine.h"
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "Utils.h"
+#include <opae/fpga.h>
+
+using namespace std;
+
+#define CHECK_ERROR(err) \
+  do { \
+    if (err != FPGA_OK) { \
+      SNUCL_ERROR("OPAE error: %s (code = %d)\n", fpgaErrStr(err), err); \
+      exit(1); \
+    } \
+  } while (false)
+
+OPAEDMAEngine::OPAEDMAEngine(size_t max_outstanding) {
+  max_outstanding_ = (max_outstanding > 0 ? max_outstanding : 1);
+  submitted_ = 0;
+  completed_ = 0;
+}
+
+uint64_t OPAEDMAEngine::Submit(const OPAEDMADescriptor& desc) {
+  if (submitted_ - completed_ >= max_outstanding_)
+    Wait(submitted_ - max_outstanding_ + 1);
+  Issue(desc);
+  return ++submitted_;
+}
+
+uint64_t OPAEDMAEngine::Poll() {
+  if (completed_ < submitted_)
+    completed_ += Retire();
+  return completed_;
+}
+
+// Short transfers finish within a few polls, well before a sleep would
+void OPAEDMAEngine::Wait(uint64_t ticket) {
+  for (int i = 0; Poll() < ticket; i++) {
+    if (i >= SPIN_POLLS)
+      usleep(1);
+  }
+}
+
+OPAEMMIODMAEngine::OPAEMMIODMAEngine(fpga_handle* handle,
+                                     size_t max_outstanding)
+    : OPAEDMAEngine(max_outstanding) {
+  handle_ = handle;
+  running_ = false;
+}
+
+void OPAEMMIODMAEngine::Issue(const OPAEDMADescriptor& desc) {
+  if (running_) {
+    queued_.push_back(desc);
+  } else {
+    Start(desc);
+    running_ = true;
+  }
+}
+
+size_t OPAEMMIODMAEngine::Retire() {
+  if (!running_)
+    return 0;
+  uint64_t status;
+  fpgaReadMMIO64(*handle_, 0, 0x10 * 4, &status);
+  if ((status & 0x3) != 0x3)
+    return 0;
+  running_ = false;
+  if (!queued_.empty()) {
+    Start(queued_.front());
+    queued_.pop_front();
+    running_ = true;
+  }
+  return 1;
+}
+
+void OPAEMMIODMAEngine::Start(const OPAEDMADescriptor& desc) {
+  fpga_result err = FPGA_OK;
+  err = fpgaWriteMMIO64(*handle_, 0, 0x16 * 4, desc.dev_addr);
+  CHECK_ERROR(err);
+  err = fpgaWriteMMIO64(*handle_, 0, 0x18 * 4, desc.host_addr);
+  CHECK_ERROR(err);
+  err = fpgaWriteMMIO64(*handle_, 0, 0x1a * 4, desc.num_lines);
+  CHECK_ERROR(err);
+  err = fpgaWriteMMIO64(*handle_, 0, (desc.to_device ? 0x12 : 0x14) * 4, 1);
+  CHECK_ERROR(err);
+}
+
+OPAESoftDMAEngine::OPAESoftDMAEngine(size_t mem_size, size_t max_outstanding)
+    : OPAEDMAEngine(max_outstanding) {
+  // Pages of device memory are only backed once they are touched
+  mem_size_ = mem_size;
+  mem_ = NULL;
+  if (mem_size > 0)
+    mem_ = (char*)mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem_ == MAP_FAILED) {
+    SNUCL_ERROR("Cannot emulate 0x%zX bytes of device memory", mem_size);
+    exit(1);
+  }
+}
+
+OPAESoftDMAEngine::~OPAESoftDMAEngine() {
+  if (mem_ != NULL)
+    munmap(mem_, mem_size_);
+}
+
+void OPAESoftDMAEngine::Issue(const OPAEDMADescriptor& desc) {
+  queued_.push_back(desc);
+}
+
+size_t OPAESoftDMAEngine::Retire() {
+  if (queued_.empty())
+    return 0;
+  OPAEDMADescriptor desc = queued_.front();
+  queued_.pop_front();
+  size_t size = desc.num_lines * LINE_SIZE;
+  if (desc.dev_addr + size > mem_size_) {
+    SNUCL_ERROR("DMA out of device memory (0x%zX + 0x%zX)", desc.dev_addr,
+                size);
+    exit(1);
+  }
+  char* host = TranslateHost(desc.host_addr, size);
+  if (desc.to_device)
+    memcpy(mem_ + desc.dev_addr, host, size);
+  else
+    memcpy(host, mem_ + desc.dev_addr, size);
+  return 1;
+}
+
+void OPAESoftDMAEngine::MapHost(uint64_t io_addr, void* ptr, size_t size) {
+  host_maps_[io_addr] = make_pair((char*)ptr, size);
+}
+
+void OPAESoftDMAEngine::UnmapHost(uint64_t io_addr) {
+  host_maps_.erase(io_addr);
+}
+
+char* OPAESoftDMAEngine::TranslateHost(uint64_t io_addr, size_t size) {
+  map<uint64_t, pair<char*, size_t> >::iterator it =
+      host_maps_.upper_bound(io_addr);
+  if (it != host_maps_.begin()) {
+    --it;
+    if (io_addr + size <= it->first + it->second.second)
+      return it->second.first + (io_addr - it->first);
+  }
+  SNUCL_ERROR("DMA to unmapped host memory (0x%lX + 0x%zX)",
+              (unsigned long)io_addr, size);
+  exit(1);
+  return NULL;
+}
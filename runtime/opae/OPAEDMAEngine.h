@@ -0,0 +1,143 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SNUCL__OPAE_DMA_ENGINE_H
+#define __SNUCL__OPAE_DMA_ENGINE_H
+
+#include <deque>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <opae/fpga.h>
+
+// A transfer of whole lines between device memory and pinned host memory
+// (given by its IO address)
+struct OPAEDMADescriptor {
+  bool to_device;
+  size_t dev_addr;
+  uint64_t host_addr;
+  size_t num_lines;
+};
+
+// Moves data between device memory and the host. Submitted transfers
+// complete in order and are numbered from 1; up to max_outstanding of them
+// are in flight, and Submit() waits for the oldest if there are more. Not
+// thread-safe.
+class OPAEDMAEngine {
+ public:
+  OPAEDMAEngine(size_t max_outstanding);
+  virtual ~OPAEDMAEngine() {}
+
+  uint64_t Submit(const OPAEDMADescriptor& desc);
+  // Returns the number of the newest completed transfer
+  uint64_t Poll();
+  void Wait(uint64_t ticket);
+  void WaitAll() { Wait(submitted_); }
+
+  // Tells the engine where pinned host memory is. Only engines that do not
+  // go through the IOMMU need this.
+  virtual void MapHost(uint64_t io_addr, void* ptr, size_t size) {}
+  virtual void UnmapHost(uint64_t io_addr) {}
+
+  static const size_t LINE_SIZE = 64;
+
+ protected:
+  virtual void Issue(const OPAEDMADescriptor& desc) = 0;
+  // Returns the number of transfers completed since the last call
+  virtual size_t Retire() = 0;
+
+ private:
+  // Polls this many times before sleeping between polls
+  static const int SPIN_POLLS = 64;
+
+  size_t max_outstanding_;
+  uint64_t submitted_;
+  uint64_t completed_;
+};
+
+// The DMA engine of the SOFF shell, driven through its MMIO registers. It
+// runs one transfer at a time, so the others wait in a software queue and
+// are started as soon as the running one is retired. The handle is read
+// through a pointer because the device reopens it on partial
+// reconfiguration.
+class OPAEMMIODMAEngine: public OPAEDMAEngine {
+ public:
+  OPAEMMIODMAEngine(fpga_handle* handle, size_t max_outstanding);
+
+ protected:
+  virtual void Issue(const OPAEDMADescriptor& desc);
+  virtual size_t Retire();
+
+ private:
+  void Start(const OPAEDMADescriptor& desc);
+
+  fpga_handle* handle_;
+  bool running_;
+  std::deque<OPAEDMADescriptor> queued_;
+};
+
+// Emulates device memory with a host array so that the transfer logic runs
+// without an FPGA. Each poll performs the oldest outstanding transfer, which
+// exposes callers that touch host memory before waiting.
+class OPAESoftDMAEngine: public OPAEDMAEngine {
+ public:
+  OPAESoftDMAEngine(size_t mem_size, size_t max_outstanding);
+  virtual ~OPAESoftDMAEngine();
+
+  virtual void MapHost(uint64_t io_addr, void* ptr, size_t size);
+  virtual void UnmapHost(uint64_t io_addr);
+
+  char* mem() const { return mem_; }
+
+ protected:
+  virtual void Issue(const OPAEDMADescriptor& desc);
+  virtual size_t Retire();
+
+ private:
+  char* TranslateHost(uint64_t io_addr, size_t size);
+
+  char* mem_;
+  size_t mem_size_;
+  // io_addr -> (ptr, size)
+  std::map<uint64_t, std::pair<char*, size_t> > host_maps_;
+  std::deque<OPAEDMADescriptor> queued_;
+};
+
+#endif // __SNUCL__OPAE_DMA_ENGINE_H
@@ -79,6 +79,15 @@ using namespace std;
     exit(1); \
   } while (false)
 
+// Compacts at barriers only if less than half of the free space is in the
+// largest free block
+#define COMPACTION_THRESHOLD 0.5
+// Lines kept by the line cache. Overridden by SNUCL_LINE_CACHE_SIZE.
+#define LINE_CACHE_DEFAULT_SIZE 4096
+// Transfers queued on the DMA engine at once. Overridden by
+// SNUCL_DMA_QUEUE_DEPTH.
+#define DMA_DEFAULT_QUEUE_DEPTH 8
+
 struct OPAEBitstream {
   const unsigned char *data;
   size_t size;
@@ -200,44 +209,132 @@ OPAEDevice::OPAEDevice(fpga_token dev_token, fpga_token acc_token, OPAE_DEVICE_T
   switch (opae_device_type) {
     case OPAE_DEVICE_A10:
       global_mem_size_ = 8L * 1024 * 1024 * 1024; // 2 x 4GB = 8GB
+      num_mem_banks_ = 2;
       break;
     case OPAE_DEVICE_D5005:
       global_mem_size_ = 32L * 1024 * 1024 * 1024; // 4 x 8GB = 32GB
+      num_mem_banks_ = 4;
       break;
-    defualt:
+    default:
       global_mem_size_ = 0;
+      num_mem_banks_ = 1;
       break;
   }
 
   max_mem_alloc_size_ = global_mem_size_;
-  mem_blocks_.emplace(0, std::make_pair(global_mem_size_, true));
-  free_blocks_by_size_.emplace(global_mem_size_, 0);
+  next_mem_bank_ = 0;
+  // One allocator shard per memory bank
+  allocator_ = new OPAEMemAllocator(0, global_mem_size_,
+                                    mem_base_addr_align_ / 8, num_mem_banks_);
+  num_evictions_ = 0;
+  evicted_bytes_ = 0;
+  num_refaults_ = 0;
+  pthread_mutex_init(&mutex_lru_, NULL);
+  compaction_enabled_ = (getenv("SNUCL_MEM_COMPACTION") != NULL);
+  num_compactions_ = 0;
+  compacted_bytes_ = 0;
+  compaction_largest_[0] = 0;
+  compaction_largest_[1] = 0;
 
   err = fpgaOpen(opae_accelerator_token_, &opae_handle_, 0);
   CHECK_ERROR(err);
   err = fpgaReset(opae_handle_);
   CHECK_ERROR(err);
 
-  opae_buffer_byte_ = 1L * 1024 * 1024 * 1024; // fit to 1GB hugepage
+  // The first 256MB of the 1GB hugepage is used as a staging buffer and the
+  // rest is used as a pool of mapped host pointers
+  opae_buffer_byte_ = 256L * 1024 * 1024;
   opae_buffer_line_ = opae_buffer_byte_ / LINE_SIZE;
-  err = fpgaPrepareBuffer(opae_handle_, opae_buffer_byte_,
+  opae_map_pool_byte_ = 768L * 1024 * 1024;
+  err = fpgaPrepareBuffer(opae_handle_, opae_buffer_byte_ + opae_map_pool_byte_,
                           (void**)&opae_buffer_ptr_, &opae_buffer_, 0);
   CHECK_ERROR(err);
   err = fpgaGetIOAddress(opae_handle_, opae_buffer_, &opae_buffer_addr_);
   CHECK_ERROR(err);
-  SNUCL_INFO("[OPAEDevice] Buffer allocated (size = 0x%zX, virtual address = 0x%zX, physical address = 0x%zX)", opae_buffer_byte_, opae_buffer_ptr_, opae_buffer_addr_);
+  SNUCL_INFO("[OPAEDevice] Buffer allocated (size = 0x%zX, virtual address = 0x%zX, physical address = 0x%zX)", opae_buffer_byte_ + opae_map_pool_byte_, opae_buffer_ptr_, opae_buffer_addr_);
+
+  opae_map_pool_ptr_ = opae_buffer_ptr_ + opae_buffer_byte_;
+  opae_map_pool_addr_ = opae_buffer_addr_ + opae_buffer_byte_;
+  map_pool_free_[0] = opae_map_pool_byte_;
+  pthread_mutex_init(&mutex_map_pool_, NULL);
+  pthread_mutex_init(&mutex_dma_, NULL);
+  size_t dma_queue_depth = DMA_DEFAULT_QUEUE_DEPTH;
+  char* dma_queue_depth_env = getenv("SNUCL_DMA_QUEUE_DEPTH");
+  if (dma_queue_depth_env != NULL)
+    dma_queue_depth = strtoull(dma_queue_depth_env, NULL, 0);
+  char* dma_engine = getenv("SNUCL_DMA_ENGINE");
+  bool soft_dma = (dma_engine != NULL && strcmp(dma_engine, "software") == 0);
+  if (soft_dma) {
+    // Kernels still run on the FPGA and do not see the emulated memory
+    SNUCL_INFO("%s", "[OPAEDevice] Using the software DMA engine");
+    dma_engine_ = new OPAESoftDMAEngine(global_mem_size_, dma_queue_depth);
+    dma_engine_->MapHost(opae_buffer_addr_, opae_buffer_ptr_,
+                         opae_buffer_byte_ + opae_map_pool_byte_);
+  } else {
+    dma_engine_ = new OPAEMMIODMAEngine(&opae_handle_, dma_queue_depth);
+  }
+  pinned_host_bytes_ = 0;
+  // The pin cache does not report its ranges to the DMA engine
+  char* pin_cache_budget = getenv("SNUCL_PIN_CACHE_BUDGET");
+  if (!soft_dma && pin_cache_budget != NULL &&
+      strtoull(pin_cache_budget, NULL, 0) > 0)
+    pin_cache_ = new OPAEPinCache(strtoull(pin_cache_budget, NULL, 0));
+  else
+    pin_cache_ = NULL;
+  // Keeps transfers from consulting a cache that never pins
+  if (pin_cache_ != NULL && !pin_cache_->enabled()) {
+    delete pin_cache_;
+    pin_cache_ = NULL;
+  }
+  size_t line_cache_size = LINE_CACHE_DEFAULT_SIZE;
+  char* line_cache_env = getenv("SNUCL_LINE_CACHE_SIZE");
+  if (line_cache_env != NULL)
+    line_cache_size = strtoull(line_cache_env, NULL, 0);
+  if (line_cache_size > 0)
+    line_cache_ = new OPAELineCache(line_cache_size);
+  else
+    line_cache_ = NULL;
+  transfer_ = new OPAETransfer(dma_engine_, opae_buffer_ptr_,
+                               opae_buffer_addr_, opae_buffer_byte_,
+                               line_cache_);
+
+  char* write_elision = getenv("SNUCL_WRITE_ELISION");
+  if (write_elision != NULL && atoi(write_elision) != 0)
+    write_filter_ = new OPAEWriteFilter(WRITE_FILTER_CHUNK_SIZE);
+  else
+    write_filter_ = NULL;
 
   device_last_kernel_ = -1;
+
+  // Transfers run on their own issuer so that they overlap kernel execution
+  EnableCopyLane();
 }
 
 OPAEDevice::~OPAEDevice() {
   fpga_result err = FPGA_OK;
+  for (std::map<char*, OPAEHostRegion>::iterator it = host_regions_.begin();
+       it != host_regions_.end();
+       ++it) {
+    if (it->second.pinned)
+      fpgaReleaseBuffer(opae_handle_, it->second.wsid);
+  }
+  if (pin_cache_ != NULL)
+    pin_cache_->Clear(opae_handle_);
   err = fpgaClose(opae_handle_);
   CHECK_ERROR(err);
   err = fpgaDestroyToken(&opae_accelerator_token_);
   CHECK_ERROR(err);
   err = fpgaDestroyToken(&opae_device_token_);
   CHECK_ERROR(err);
+  pthread_mutex_destroy(&mutex_map_pool_);
+  pthread_mutex_destroy(&mutex_dma_);
+  pthread_mutex_destroy(&mutex_lru_);
+  delete allocator_;
+  delete write_filter_;
+  delete pin_cache_;
+  delete transfer_;
+  delete line_cache_;
+  delete dma_engine_;
   for (std::map<CLProgram*, CLKernel*>::iterator it = all_kernel_.begin();
        it != all_kernel_.end();
        ++it) {
@@ -275,11 +372,40 @@ void OPAEDevice::LaunchKernel(CLCommand* command, CLKernel* kernel,
     kernel_id = 0;
   }
 
+  if (write_filter_ != NULL) {
+    // Arguments the kernel may write no longer match their last upload
+    for (map<cl_uint, CLKernelArg*>::iterator it = kernel_args->begin();
+         it != kernel_args->end();
+         ++it) {
+      CLMem* mem = it->second->mem;
+      if (mem != NULL && mem->IsWritable() &&
+          !kernel->IsArgReadOnly(it->first))
+        write_filter_->Invalidate(GetDevAddr(mem), mem->size());
+    }
+  }
+
   SetKernelParam(kernel, work_dim, gwo, gws, lws, nwg, kernel_args);
   fpga_result err = FPGA_OK;
   err = fpgaWriteMMIO64(opae_handle_, 0, 0x1002 * 4, kernel_id);
   CHECK_ERROR(err);
   BusyWait(0x1004 * 4, 0x8, 0x8, 1);
+
+  if (line_cache_ != NULL) {
+    // Cached lines of arguments the kernel may have written are stale
+    vector<pair<size_t, size_t> > written;
+    for (map<cl_uint, CLKernelArg*>::iterator it = kernel_args->begin();
+         it != kernel_args->end();
+         ++it) {
+      CLMem* mem = it->second->mem;
+      if (mem != NULL && mem->IsWritable() &&
+          !kernel->IsArgReadOnly(it->first))
+        written.push_back(make_pair(GetDevAddr(mem), mem->size()));
+    }
+    pthread_mutex_lock(&mutex_dma_);
+    for (size_t i = 0; i < written.size(); i++)
+      line_cache_->Invalidate(written[i].first, written[i].second);
+    pthread_mutex_unlock(&mutex_dma_);
+  }
 }
 
 void OPAEDevice::LaunchNativeKernel(CLCommand* command,
@@ -289,107 +415,146 @@ void OPAEDevice::LaunchNativeKernel(CLCommand* command,
                                       ptrdiff_t* mem_offsets) {
 }
 
-void OPAEDevice::DMARead(size_t dev_addr, size_t host_addr, size_t num_lines) {
-  SNUCL_INFO("[DMARead] Will copy 0x%zX lines from device memory(0x%zX) to buffer(pa=0x%zX)", num_lines, dev_addr, host_addr);
-  assert(dev_addr % LINE_SIZE == 0);
-  assert(host_addr % LINE_SIZE == 0);
-  assert(num_lines <= opae_buffer_line_);
-  fpga_result err = FPGA_OK;
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x16 * 4, dev_addr);
-  CHECK_ERROR(err);
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x18 * 4, host_addr);
-  CHECK_ERROR(err);
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x1a * 4, num_lines);
-  CHECK_ERROR(err);
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x14 * 4, 1);
-  CHECK_ERROR(err);
-  BusyWait(0x10 * 4, 0x3, 0x3, 1);
-  SNUCL_INFO("[DMARead] Done");
+bool OPAEDevice::GetPinnedIOAddress(size_t dev_addr, void* host_addr,
+                                    size_t size, uint64_t* io_addr) {
+  char* first = (char*)host_addr;
+  if ((size_t)first % LINE_SIZE != dev_addr % LINE_SIZE)
+    return false;
+  if (first >= opae_map_pool_ptr_ &&
+      first + size <= opae_map_pool_ptr_ + opae_map_pool_byte_) {
+    *io_addr = opae_map_pool_addr_ + (first - opae_map_pool_ptr_);
+    return true;
+  }
+  std::map<char*, OPAEHostRegion>::iterator it =
+      host_regions_.upper_bound(first);
+  if (it != host_regions_.begin()) {
+    --it;
+    if (first + size <= it->first + it->second.size) {
+      if (!it->second.pinned)
+        return false;
+      *io_addr = it->second.io_addr + (first - it->first);
+      return true;
+    }
+  }
+  if (pin_cache_ != NULL)
+    return pin_cache_->Lookup(opae_handle_, first, size, io_addr);
+  return false;
 }
 
-void OPAEDevice::DMAWrite(size_t dev_addr, size_t host_addr, size_t num_lines) {
-  SNUCL_INFO("[DMAWrite] Will copy 0x%zX lines from buffer(pa=0x%zX) to device memory(0x%zX)", num_lines, host_addr, dev_addr);
-  assert(dev_addr % LINE_SIZE == 0);
-  assert(host_addr % LINE_SIZE == 0);
-  assert(num_lines <= opae_buffer_line_);
-  fpga_result err = FPGA_OK;
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x16 * 4, dev_addr);
-  CHECK_ERROR(err);
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x18 * 4, host_addr);
-  CHECK_ERROR(err);
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x1a * 4, num_lines);
-  CHECK_ERROR(err);
-  err = fpgaWriteMMIO64(opae_handle_, 0, 0x12 * 4, 1);
-  CHECK_ERROR(err);
-  BusyWait(0x10 * 4, 0x3, 0x3, 1);
-  SNUCL_INFO("[DMAWrite] Done");
-}
-
-// TODO(heehoon): size == 0?
-void OPAEDevice::ReadBufferImpl(size_t dev_addr, void* host_addr, size_t size) {
-  size_t first_byte = dev_addr;
-  size_t last_byte = first_byte + size - 1;
-  size_t first_line = first_byte / LINE_SIZE;
-  size_t last_line = last_byte / LINE_SIZE;
-
-  SNUCL_INFO("[ReadBufferImpl] Will copy 0x%zX bytes from device memory(0x%zX) to user memory(0x%zX)", size, first_byte, host_addr);
-  while (last_line - first_line + 1 > 0) {
-    size_t lines_now = std::min(opae_buffer_line_, last_line - first_line + 1);
-    size_t bytes_now = std::min(opae_buffer_byte_ - first_byte % LINE_SIZE, last_byte - first_byte + 1);
-    DMARead(first_line * LINE_SIZE, opae_buffer_addr_, lines_now);
-    memcpy(host_addr, opae_buffer_ptr_ + first_byte % LINE_SIZE, bytes_now);
-    SNUCL_INFO("[ReadBufferImpl] Copied 0x%zX bytes from buffer(va=0x%zX) to user memory(0x%zX)", bytes_now, opae_buffer_ptr_ + first_byte % LINE_SIZE, host_addr);
-    first_line += lines_now;
-    first_byte += bytes_now;
-    host_addr = (char*)host_addr + bytes_now;
-  }
-  SNUCL_INFO("[ReadBufferImpl] Done");
-}
-
-void OPAEDevice::WriteBufferImpl(size_t dev_addr, void* host_addr, size_t size) {
-  size_t first_byte = dev_addr;
-  size_t last_byte = first_byte + size - 1;
-  size_t first_line = first_byte / LINE_SIZE;
-  size_t last_line = last_byte / LINE_SIZE;
-
-  SNUCL_INFO("[WriteBufferImpl] Will copy 0x%zX bytes from user memory(0x%zX) to device memory(0x%zX)", size, host_addr, first_byte);
-  while (last_line - first_line + 1 > 0) {
-    size_t lines_now = std::min(opae_buffer_line_, last_line - first_line + 1);
-    size_t bytes_now = std::min(opae_buffer_byte_ - first_byte % LINE_SIZE, last_byte - first_byte + 1);
-    if (first_byte % LINE_SIZE != 0) {
-      SNUCL_INFO("[WriteBufferImpl] First byte is unaligned (0x%zX %% 0x%zX != 0x%zX)", first_byte, LINE_SIZE, 0);
-      DMARead(first_line * LINE_SIZE, opae_buffer_addr_, 1);
-    }
-    if ((first_byte + bytes_now - 1) % LINE_SIZE != LINE_SIZE - 1) {
-      SNUCL_INFO("[WriteBufferImpl] Last byte is unaligned (0x%zX %% 0x%zX != 0x%zX)", first_byte + bytes_now - 1, LINE_SIZE, LINE_SIZE - 1);
-      DMARead((first_line + lines_now - 1) * LINE_SIZE, opae_buffer_addr_ + (lines_now - 1) * LINE_SIZE, 1);
+// Falls back to the staging buffer if the range cannot be pinned, e.g. when
+// the driver does not take preallocated buffers
+bool OPAEDevice::RegisterHostMem(void* ptr, size_t size) {
+  char* first = (char*)ptr;
+  pthread_mutex_lock(&mutex_dma_);
+  std::map<char*, OPAEHostRegion>::iterator next =
+      host_regions_.lower_bound(first);
+  if ((next != host_regions_.end() && next->first < first + size) ||
+      (next != host_regions_.begin() &&
+       std::prev(next)->first + std::prev(next)->second.size > first)) {
+    pthread_mutex_unlock(&mutex_dma_);
+    return false;
+  }
+
+  OPAEHostRegion region;
+  region.size = size;
+  region.pinned = false;
+  region.wsid = 0;
+  region.io_addr = 0;
+  void* buf_addr = ptr;
+  fpga_result err = fpgaPrepareBuffer(opae_handle_, size, &buf_addr,
+                                      &region.wsid, FPGA_BUF_PREALLOCATED);
+  if (err == FPGA_OK) {
+    err = fpgaGetIOAddress(opae_handle_, region.wsid, &region.io_addr);
+    if (err == FPGA_OK) {
+      region.pinned = true;
+      pinned_host_bytes_ += size;
+      dma_engine_->MapHost(region.io_addr, ptr, size);
+    } else {
+      fpgaReleaseBuffer(opae_handle_, region.wsid);
     }
-    memcpy(opae_buffer_ptr_ + first_byte % LINE_SIZE, host_addr, bytes_now);
-    SNUCL_INFO("[WriteBufferImpl] Copied 0x%zX bytes from user memory(0x%zX) to buffer(va=0x%zX)", bytes_now, host_addr, opae_buffer_ptr_ + first_byte % LINE_SIZE);
-    DMAWrite(first_line * LINE_SIZE, opae_buffer_addr_, lines_now);
-    first_line += lines_now;
-    first_byte += bytes_now;
-    host_addr = (char*)host_addr + bytes_now;
   }
-  SNUCL_INFO("[WriteBufferImpl] Done");
+  if (!region.pinned) {
+    SNUCL_INFO("[RegisterHostMem] Cannot pin 0x%zX bytes at %p: %s", size,
+               ptr, fpgaErrStr(err));
+  }
+  host_regions_[first] = region;
+  pthread_mutex_unlock(&mutex_dma_);
+  return true;
+}
+
+bool OPAEDevice::UnregisterHostMem(void* ptr) {
+  pthread_mutex_lock(&mutex_dma_);
+  std::map<char*, OPAEHostRegion>::iterator it =
+      host_regions_.find((char*)ptr);
+  if (it == host_regions_.end()) {
+    pthread_mutex_unlock(&mutex_dma_);
+    return false;
+  }
+  if (it->second.pinned) {
+    dma_engine_->UnmapHost(it->second.io_addr);
+    fpga_result err = fpgaReleaseBuffer(opae_handle_, it->second.wsid);
+    CHECK_ERROR(err);
+    pinned_host_bytes_ -= it->second.size;
+  }
+  host_regions_.erase(it);
+  pthread_mutex_unlock(&mutex_dma_);
+  return true;
+}
+
+void OPAEDevice::ReadBufferImpl(size_t dev_addr, void* host_addr,
+                                size_t size) {
+  uint64_t io_addr;
+  pthread_mutex_lock(&mutex_dma_);
+  if (GetPinnedIOAddress(dev_addr, host_addr, size, &io_addr))
+    transfer_->ReadPinned(dev_addr, host_addr, io_addr, size);
+  else
+    transfer_->Read(dev_addr, host_addr, size);
+  pthread_mutex_unlock(&mutex_dma_);
+}
+
+void OPAEDevice::WriteBufferImpl(size_t dev_addr, void* host_addr,
+                                 size_t size) {
+  if (write_filter_ == NULL) {
+    WriteBufferRange(dev_addr, host_addr, size);
+    return;
+  }
+  vector<pair<size_t, size_t> > ranges;
+  write_filter_->Filter(dev_addr, host_addr, size, ranges);
+  for (vector<pair<size_t, size_t> >::iterator it = ranges.begin();
+       it != ranges.end();
+       ++it) {
+    WriteBufferRange(dev_addr + it->first, (char*)host_addr + it->first,
+                     it->second);
+  }
+}
+
+void OPAEDevice::WriteBufferRange(size_t dev_addr, void* host_addr,
+                                  size_t size) {
+  uint64_t io_addr;
+  pthread_mutex_lock(&mutex_dma_);
+  if (GetPinnedIOAddress(dev_addr, host_addr, size, &io_addr))
+    transfer_->WritePinned(dev_addr, host_addr, io_addr, size);
+  else
+    transfer_->Write(dev_addr, host_addr, size);
+  pthread_mutex_unlock(&mutex_dma_);
 }
 
 void OPAEDevice::ReadBuffer(CLCommand* command, CLMem* mem_src,
                             size_t off_src, size_t size, void* ptr) {
-  ReadBufferImpl((size_t)mem_src->GetDevSpecific(this) + off_src, ptr, size);
+  ReadBufferImpl(GetDevAddr(mem_src) + off_src, ptr, size);
 }
 
 void OPAEDevice::WriteBuffer(CLCommand* command, CLMem* mem_dst,
                                size_t off_dst, size_t size, void* ptr) {
-  WriteBufferImpl((size_t)mem_dst->GetDevSpecific(this) + off_dst, ptr, size);
+  WriteBufferImpl(GetDevAddr(mem_dst) + off_dst, ptr, size);
 }
 
 void OPAEDevice::CopyBuffer(CLCommand* command, CLMem* mem_src,
                               CLMem* mem_dst, size_t off_src, size_t off_dst,
                               size_t size) {
   void *buf = malloc(size);
-  ReadBufferImpl((size_t)mem_src->GetDevSpecific(this) + off_src, buf, size);
-  WriteBufferImpl((size_t)mem_dst->GetDevSpecific(this) + off_dst, buf, size);
+  ReadBufferImpl(GetDevAddr(mem_src) + off_src, buf, size);
+  WriteBufferImpl(GetDevAddr(mem_dst) + off_dst, buf, size);
   free(buf);
 }
 
@@ -426,7 +591,7 @@ void OPAEDevice::ReadBufferRect(CLCommand* command, CLMem* mem_src,
                                   size_t src_slice_pitch, size_t dst_row_pitch,
                                   size_t dst_slice_pitch, void* ptr) {
   void *buf = malloc(mem_src->size());
-  ReadBufferImpl((size_t)mem_src->GetDevSpecific(this), buf, mem_src->size());
+  ReadBufferImpl(GetDevAddr(mem_src), buf, mem_src->size());
   CopyRegion(buf, ptr, 3, src_origin, dst_origin,
              region, 1, src_row_pitch, src_slice_pitch, dst_row_pitch,
              dst_slice_pitch);
@@ -439,11 +604,11 @@ void OPAEDevice::WriteBufferRect(CLCommand* command, CLMem* mem_dst,
                                    size_t src_slice_pitch, size_t dst_row_pitch,
                                    size_t dst_slice_pitch, void* ptr) {
   void *buf = malloc(mem_dst->size());
-  ReadBufferImpl((size_t)mem_dst->GetDevSpecific(this), buf, mem_dst->size());
+  ReadBufferImpl(GetDevAddr(mem_dst), buf, mem_dst->size());
   CopyRegion(ptr, buf, 3, src_origin, dst_origin,
              region, 1, src_row_pitch, src_slice_pitch, dst_row_pitch,
              dst_slice_pitch);
-  WriteBufferImpl((size_t)mem_dst->GetDevSpecific(this), buf, mem_dst->size());
+  WriteBufferImpl(GetDevAddr(mem_dst), buf, mem_dst->size());
   free(buf);
 }
 
@@ -455,12 +620,12 @@ void OPAEDevice::CopyBufferRect(CLCommand* command, CLMem* mem_src,
                                   size_t dst_slice_pitch) {
   void *buf_src = malloc(mem_src->size());
   void *buf_dst = malloc(mem_dst->size());
-  ReadBufferImpl((size_t)mem_src->GetDevSpecific(this), buf_src, mem_src->size());
-  ReadBufferImpl((size_t)mem_dst->GetDevSpecific(this), buf_dst, mem_dst->size());
+  ReadBufferImpl(GetDevAddr(mem_src), buf_src, mem_src->size());
+  ReadBufferImpl(GetDevAddr(mem_dst), buf_dst, mem_dst->size());
   CopyRegion(buf_src, buf_dst, 3,
              src_origin, dst_origin, region, 1, src_row_pitch, src_slice_pitch,
              dst_row_pitch, dst_slice_pitch);
-  WriteBufferImpl((size_t)mem_dst->GetDevSpecific(this), buf_dst, mem_dst->size());
+  WriteBufferImpl(GetDevAddr(mem_dst), buf_dst, mem_dst->size());
   free(buf_src);
   free(buf_dst);
 }
@@ -474,7 +639,8 @@ void OPAEDevice::FillBuffer(CLCommand* command, CLMem* mem_dst, void* pattern,
     memcpy((char*)buf + index, pattern, pattern_size);
     index += pattern_size;
   }
-  WriteBufferImpl((size_t)mem_dst->GetDevSpecific(this) + off_dst, buf, mem_dst->size());
+  WriteBufferImpl(GetDevAddr(mem_dst) + off_dst, buf, size);
+  free(buf);
 }
 
 void OPAEDevice::FillImage(CLCommand* command, CLMem* mem_dst,
@@ -534,81 +700,386 @@ void OPAEDevice::LinkProgram(CLCommand* command, CLProgram* program,
 }
 
 void* OPAEDevice::AllocMem(CLMem* mem) {
-  SNUCL_INFO("[AllocMem] malloc(%zX) requested", mem->size());
-
-  // Find a free block which the request fits
-  size_t aligned_size = (mem->size() + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
-  auto it = free_blocks_by_size_.lower_bound(std::make_pair(aligned_size, 0));
-  if (it == free_blocks_by_size_.end()) {
-    SNUCL_ERROR_EXIT("[AllocMem] Cannot allocate %zX bytes", aligned_size);
+  // A sub-buffer is a view of its parent and is never evicted by itself
+  if (mem->IsSubBuffer())
+    return (void*)(GetDevAddr(mem->parent()) + mem->offset());
+
+  // A growable buffer reserves its whole capacity so that it grows in place
+  SNUCL_INFO("[AllocMem] malloc(%zX) requested", mem->capacity());
+
+  int bank = SelectMemBank(mem);
+  size_t addr;
+  bool allocated = allocator_->Alloc(mem->capacity(), &addr, bank);
+  pthread_mutex_lock(&mutex_lru_);
+  if (!allocated) {
+    // Oversubscribed; make room by evicting the least recently used objects
+    allocator_->FlushCaches();
+    // Try to close the gaps first if there is enough free space in total
+    if (compaction_enabled_ &&
+        allocator_->GetFreeBytes() >= mem->capacity()) {
+      CompactMemLocked();
+      allocated = allocator_->Alloc(mem->capacity(), &addr, bank);
+    }
+    while (!allocated && !allocator_->Alloc(mem->capacity(), &addr, bank)) {
+      if (!EvictMem(bank)) {
+        pthread_mutex_unlock(&mutex_lru_);
+        SNUCL_ERROR_EXIT("[AllocMem] Cannot allocate %zX bytes",
+                         mem->capacity());
+      }
+    }
   }
+  if (mem->IsEvictedFrom(this))
+    num_refaults_++;
+  lru_mems_.push_back(std::make_pair(mem, addr));
+  lru_pos_[mem] = std::prev(lru_mems_.end());
+  pthread_mutex_unlock(&mutex_lru_);
 
-  // Remove the free block
-  size_t free_block_size = it->first;
-  size_t free_block_addr = it->second;
-  free_blocks_by_size_.erase(it);
-  mem_blocks_.erase(free_block_addr);
-  SNUCL_INFO("[AllocMem] Remove free block (addr=%zX, size=%zX)", free_block_addr, free_block_size);
+  return (void*)addr;
+}
 
-  // If the free block is bigger than requested size, segment it
-  if (free_block_size > aligned_size) {
-    size_t new_size = free_block_size - aligned_size;
-    size_t new_addr = free_block_addr + aligned_size;
-    free_blocks_by_size_.emplace(new_size, new_addr);
-    mem_blocks_.emplace(new_addr, std::make_pair(new_size, true));
-    SNUCL_INFO("[AllocMem] Add free block (addr=%zX, size=%zX)", new_addr, new_size);
+void OPAEDevice::FreeMem(CLMem* mem, void* dev_specific) {
+  size_t addr = (size_t)dev_specific;
+  SNUCL_INFO("[FreeMem] free(%zX) requested", addr);
+
+  pthread_mutex_lock(&mutex_lru_);
+  auto pos = lru_pos_.find(mem);
+  bool evicted = (pos == lru_pos_.end());
+  if (!evicted) {
+    // Compaction may have moved the object since the caller read the address
+    addr = pos->second->second;
+    lru_mems_.erase(pos->second);
+    lru_pos_.erase(pos);
+  }
+  pthread_mutex_unlock(&mutex_lru_);
+  if (!evicted) {
+    if (write_filter_ != NULL)
+      write_filter_->Invalidate(addr, mem->capacity());
+    allocator_->Free(addr);
   }
+}
 
-  // Insert the allocated block
-  mem_blocks_.emplace(free_block_addr, std::make_pair(aligned_size, false));
-  SNUCL_INFO("[AllocMem] Add used block (addr=%zX, size=%zX)", free_block_addr, aligned_size);
+int OPAEDevice::GetMemBank(CLMem* mem) {
+  return allocator_->GetShard(GetDevAddr(mem));
+}
 
-  return (void*)free_block_addr;
+int OPAEDevice::GetNumMemBanks() {
+  return num_mem_banks_;
 }
 
-void OPAEDevice::FreeMem(CLMem* mem, void* dev_specific) {
+// Returns -1 if the buffer can be placed anywhere
+int OPAEDevice::SelectMemBank(CLMem* mem) {
+  cl_mem_flags flags = mem->flags();
+  if (flags & CL_MEM_BANK_SELECT_MASK_SNUCL) {
+    int bank = ((flags & CL_MEM_BANK_SELECT_MASK_SNUCL) >> 16) - 1;
+    if (bank < num_mem_banks_)
+      return bank;
+    SNUCL_ERROR("[SelectMemBank] Bank %d does not exist", bank);
+    return -1;
+  }
+  if (flags & CL_MEM_BANK_INTERLEAVED_SNUCL) {
+    return __sync_fetch_and_add(&next_mem_bank_, 1) % num_mem_banks_;
+  }
+  if (flags & CL_MEM_BANK_AUTO_SNUCL) {
+    int bank = 0;
+    size_t max_free_bytes = 0;
+    for (int i = 0; i < num_mem_banks_; i++) {
+      size_t free_bytes = allocator_->GetFreeBytes(i);
+      if (free_bytes > max_free_bytes) {
+        bank = i;
+        max_free_bytes = free_bytes;
+      }
+    }
+    return bank;
+  }
+  return -1;
+}
+
+size_t OPAEDevice::GetDevAddr(CLMem* mem) {
+  // The parent may have been evicted and reallocated since the sub-buffer
+  // was created
+  if (mem->IsSubBuffer())
+    return GetDevAddr(mem->parent()) + mem->offset();
   size_t addr = (size_t)mem->GetDevSpecific(this);
-  SNUCL_INFO("[FreeMem] free(%zX) requested", addr);
+  // The recency order is approximate; never wait for an allocation here
+  if (pthread_mutex_trylock(&mutex_lru_) == 0) {
+    auto pos = lru_pos_.find(mem);
+    if (pos != lru_pos_.end())
+      lru_mems_.splice(lru_mems_.end(), lru_mems_, pos->second);
+    pthread_mutex_unlock(&mutex_lru_);
+  }
+  return addr;
+}
 
-  auto it = mem_blocks_.find(addr);
-  assert(it != mem_blocks_.end() && !it->second.second);
-
-  size_t new_size = it->second.first;
-  size_t new_addr = it->first;
-  SNUCL_INFO("[FreeMem] Remove used block (addr=%zX, size=%zX)", new_addr, new_size);
-
-  if (it != mem_blocks_.begin()) {
-    auto prev = std::prev(it);
-    if (prev->second.second) { // prev block is free => merge
-      size_t prev_size = prev->second.first;
-      size_t prev_addr = prev->first;
-      free_blocks_by_size_.erase(std::make_pair(prev_size, prev_addr));
-      mem_blocks_.erase(prev);
-      SNUCL_INFO("[FreeMem] Remove free block (addr=%zX, size=%zX)", prev_addr, prev_size);
-      new_size += prev_size;
-      new_addr = prev_addr;
+// Called with mutex_lru_ held. Only evicts from the given bank unless it is -1.
+// The victim is taken off the LRU list under the lock, and the lock is
+// released while its contents are copied to the host.
+bool OPAEDevice::EvictMem(int bank) {
+  CLMem* victim = NULL;
+  size_t addr = 0;
+  for (auto it = lru_mems_.begin(); it != lru_mems_.end(); ++it) {
+    if (bank >= 0 && allocator_->GetShard(it->second) != bank)
+      continue;
+    if (!it->first->TryBeginEvict())
+      continue; // in use by a command
+    victim = it->first;
+    addr = it->second;
+    lru_pos_.erase(victim);
+    lru_mems_.erase(it);
+    break;
+  }
+  if (victim == NULL)
+    return false;
+
+  pthread_mutex_unlock(&mutex_lru_);
+  SNUCL_INFO("[EvictMem] Evict memory object (addr=%zX, size=%zX)", addr, victim->size());
+  // Keep the ranges whose only valid copy is in this device in the host
+  std::vector<CLMemRange> ranges;
+  victim->GetExclusiveRanges(this, ranges);
+  if (!ranges.empty())
+    victim->AllocHostPtr();
+  for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+    ReadBufferImpl(addr + range->offset,
+                   (char*)victim->GetHostPtr() + range->offset, range->size);
+    victim->AddLatest(LATEST_HOST, range->offset, range->size);
+  }
+  victim->EvictDevSpecific(this);
+  if (write_filter_ != NULL)
+    write_filter_->Invalidate(addr, victim->capacity());
+  allocator_->Free(addr);
+  size_t size = victim->size();
+  victim->EndEvict();
+
+  pthread_mutex_lock(&mutex_lru_);
+  num_evictions_++;
+  evicted_bytes_ += size;
+  return true;
+}
+
+void OPAEDevice::CompactMem() {
+  if (!compaction_enabled_)
+    return;
+  pthread_mutex_lock(&mutex_lru_);
+  allocator_->FlushCaches();
+  // Nothing to gain if the free space is already in one piece
+  if (allocator_->GetFragmentation() >= COMPACTION_THRESHOLD)
+    CompactMemLocked();
+  pthread_mutex_unlock(&mutex_lru_);
+}
+
+// Called with mutex_lru_ held. Slides each buffer that is not in use down to
+// the end of the previous one in the same bank. Small objects and buffers
+// that span banks stay where they are. The lock is released while a buffer
+// is copied, so the snapshot is checked against lru_pos_ before each move.
+void OPAEDevice::CompactMemLocked() {
+  size_t largest_before = allocator_->GetLargestFreeBlock();
+  std::map<size_t, CLMem*> mems; // addr -> mem
+  for (auto it = lru_mems_.begin(); it != lru_mems_.end(); ++it)
+    mems[it->second] = it->first;
+
+  size_t moved_bytes = 0;
+  int shard = -1;
+  size_t target = 0;
+  for (auto it = mems.begin(); it != mems.end(); ++it) {
+    size_t addr = it->first;
+    CLMem* mem = it->second;
+    // Freed or moved by another thread while the lock was released
+    auto pos = lru_pos_.find(mem);
+    if (pos == lru_pos_.end() || pos->second->second != addr)
+      continue;
+    size_t size = (mem->capacity() + OPAEMemHeap::UNIT_SIZE - 1) /
+                  OPAEMemHeap::UNIT_SIZE * OPAEMemHeap::UNIT_SIZE;
+    if (allocator_->GetShard(addr) != shard) {
+      shard = allocator_->GetShard(addr);
+      target = allocator_->GetShardBase(shard);
+    }
+    // AllocAt() fails unless the whole target range is free
+    if (target < addr && mem->TryBeginEvict()) {
+      if (allocator_->AllocAt(target, size)) {
+        SNUCL_INFO("[CompactMem] Move memory object (addr=%zX -> %zX, "
+                   "size=%zX)", addr, target, mem->size());
+        // The object cannot be used, evicted, or freed until EndEvict()
+        pthread_mutex_unlock(&mutex_lru_);
+        if (write_filter_ != NULL)
+          write_filter_->Invalidate(target, mem->capacity());
+        MoveMem(addr, target, mem->size());
+        mem->RelocateDevSpecific(this, (void*)target);
+        if (write_filter_ != NULL)
+          write_filter_->Invalidate(addr, mem->capacity());
+        allocator_->Free(addr);
+        pthread_mutex_lock(&mutex_lru_);
+        lru_pos_[mem]->second = target;
+        moved_bytes += mem->size();
+        addr = target;
+      }
+      mem->EndEvict();
     }
+    target = std::max(target, addr + size);
   }
 
-  auto next = std::next(it);
-  if (next != mem_blocks_.end()) {
-    if (next->second.second) { // next block is free => merge
-      size_t next_size = next->second.first;
-      size_t next_addr = next->first;
-      free_blocks_by_size_.erase(std::make_pair(next_size, next_addr));
-      mem_blocks_.erase(next);
-      SNUCL_INFO("[FreeMem] Remove free block (addr=%zX, size=%zX)", next_addr, next_size);
-      new_size += next_size;
+  size_t largest_after = allocator_->GetLargestFreeBlock();
+  SNUCL_INFO("[CompactMem] Moved %zX bytes, largest free block %zX -> %zX",
+             moved_bytes, largest_before, largest_after);
+  num_compactions_++;
+  compacted_bytes_ += moved_bytes;
+  compaction_largest_[0] = largest_before;
+  compaction_largest_[1] = largest_after;
+}
+
+// There is no on-card copy engine, so the contents go through the host
+void OPAEDevice::MoveMem(size_t src_addr, size_t dst_addr, size_t size) {
+  size_t chunk_size = std::min(size, (size_t)COMPACTION_CHUNK_SIZE);
+  char* buf = (char*)malloc(chunk_size);
+  for (size_t offset = 0; offset < size; offset += chunk_size) {
+    size_t cb = std::min(chunk_size, size - offset);
+    ReadBufferImpl(src_addr + offset, buf, cb);
+    WriteBufferImpl(dst_addr + offset, buf, cb);
+  }
+  free(buf);
+}
+
+void* OPAEDevice::AllocMapPtr(CLMem* mem, size_t offset, size_t size) {
+  // The pointer has the same offset within a line as the device address, so
+  // that the region can be transferred without the staging buffer
+  size_t head = offset % LINE_SIZE;
+  size_t block_size = (head + size + LINE_SIZE - 1) / LINE_SIZE * LINE_SIZE;
+  void* ptr = NULL;
+
+  pthread_mutex_lock(&mutex_map_pool_);
+  for (std::map<size_t, size_t>::iterator it = map_pool_free_.begin();
+       it != map_pool_free_.end();
+       ++it) {
+    if (it->second >= block_size) {
+      size_t block_offset = it->first;
+      size_t remaining = it->second - block_size;
+      map_pool_free_.erase(it);
+      if (remaining > 0)
+        map_pool_free_[block_offset + block_size] = remaining;
+      ptr = opae_map_pool_ptr_ + block_offset + head;
+      map_pool_used_[ptr] = std::make_pair(block_offset, block_size);
+      break;
     }
   }
+  pthread_mutex_unlock(&mutex_map_pool_);
 
-  // Remove the allocated block
-  mem_blocks_.erase(it);
+  if (ptr == NULL) {
+    SNUCL_INFO("[AllocMapPtr] Map pool exhausted (size = 0x%zX)", size);
+  }
+  return ptr;
+}
+
+void OPAEDevice::FreeMapPtr(void* ptr) {
+  pthread_mutex_lock(&mutex_map_pool_);
+  std::map<void*, std::pair<size_t, size_t> >::iterator used =
+      map_pool_used_.find(ptr);
+  assert(used != map_pool_used_.end());
+  size_t block_offset = used->second.first;
+  size_t block_size = used->second.second;
+  map_pool_used_.erase(used);
+
+  std::map<size_t, size_t>::iterator next =
+      map_pool_free_.lower_bound(block_offset);
+  if (next != map_pool_free_.end() &&
+      next->first == block_offset + block_size) {
+    block_size += next->second;
+    map_pool_free_.erase(next++);
+  }
+  if (next != map_pool_free_.begin()) {
+    std::map<size_t, size_t>::iterator prev = std::prev(next);
+    if (prev->first + prev->second == block_offset) {
+      block_offset = prev->first;
+      block_size += prev->second;
+      map_pool_free_.erase(prev);
+    }
+  }
+  map_pool_free_[block_offset] = block_size;
+  pthread_mutex_unlock(&mutex_map_pool_);
+}
 
-  // Insert the free block
-  free_blocks_by_size_.emplace(new_size, new_addr);
-  mem_blocks_.emplace(new_addr, std::make_pair(new_size, true));
-  SNUCL_INFO("[FreeMem] Add free block (addr=%zX, size=%zX)", new_addr, new_size);
+cl_int OPAEDevice::GetDeviceExtInfo(cl_device_info param_name,
+                                    size_t param_value_size,
+                                    void* param_value,
+                                    size_t* param_value_size_ret) {
+  cl_ulong free_bytes = allocator_->GetFreeBytes();
+  cl_ulong largest_free_block = allocator_->GetLargestFreeBlock();
+  cl_double fragmentation = allocator_->GetFragmentation();
+  cl_ulong committed_bytes = 0;
+  cl_ulong reserved_bytes = 0;
+  pthread_mutex_lock(&mutex_lru_);
+  for (auto it = lru_mems_.begin(); it != lru_mems_.end(); ++it) {
+    committed_bytes += it->first->size();
+    reserved_bytes += it->first->capacity();
+  }
+  pthread_mutex_unlock(&mutex_lru_);
+  cl_ulong elided_bytes = 0;
+  cl_ulong hashed_bytes = 0;
+  cl_ulong hash_time = 0;
+  cl_ulong pin_cache_hits = 0;
+  cl_ulong pin_cache_misses = 0;
+  cl_ulong pin_cache_bytes = 0;
+  cl_ulong line_cache_hits = 0;
+  cl_ulong line_cache_misses = 0;
+  if (pin_cache_ != NULL) {
+    pthread_mutex_lock(&mutex_dma_);
+    pin_cache_hits = pin_cache_->hits();
+    pin_cache_misses = pin_cache_->misses();
+    pin_cache_bytes = pin_cache_->pinned_bytes();
+    pthread_mutex_unlock(&mutex_dma_);
+  }
+  if (line_cache_ != NULL) {
+    pthread_mutex_lock(&mutex_dma_);
+    line_cache_hits = line_cache_->hits();
+    line_cache_misses = line_cache_->misses();
+    pthread_mutex_unlock(&mutex_dma_);
+  }
+  if (write_filter_ != NULL) {
+    elided_bytes = write_filter_->elided_bytes();
+    hashed_bytes = write_filter_->hashed_bytes();
+    hash_time = write_filter_->hash_time();
+  }
+
+  switch (param_name) {
+    GET_OBJECT_INFO(CL_DEVICE_MEM_EVICTION_COUNT_SNUCL, cl_ulong,
+                    num_evictions_);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_EVICTED_BYTES_SNUCL, cl_ulong,
+                    evicted_bytes_);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_REFAULT_COUNT_SNUCL, cl_ulong,
+                    num_refaults_);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_FREE_BYTES_SNUCL, cl_ulong, free_bytes);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_LARGEST_FREE_BLOCK_SNUCL, cl_ulong,
+                    largest_free_block);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_FRAGMENTATION_SNUCL, cl_double,
+                    fragmentation);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_BANKS_SNUCL, cl_uint, num_mem_banks_);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_COMMITTED_BYTES_SNUCL, cl_ulong,
+                    committed_bytes);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_RESERVED_BYTES_SNUCL, cl_ulong,
+                    reserved_bytes);
+    GET_OBJECT_INFO(CL_DEVICE_WRITE_ELIDED_BYTES_SNUCL, cl_ulong,
+                    elided_bytes);
+    GET_OBJECT_INFO(CL_DEVICE_WRITE_HASHED_BYTES_SNUCL, cl_ulong,
+                    hashed_bytes);
+    GET_OBJECT_INFO(CL_DEVICE_WRITE_HASH_TIME_SNUCL, cl_ulong, hash_time);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_COMPACTION_COUNT_SNUCL, cl_ulong,
+                    num_compactions_);
+    GET_OBJECT_INFO(CL_DEVICE_MEM_COMPACTED_BYTES_SNUCL, cl_ulong,
+                    compacted_bytes_);
+    GET_OBJECT_INFO_A(CL_DEVICE_MEM_COMPACTION_GAIN_SNUCL, cl_ulong,
+                      compaction_largest_, 2);
+    GET_OBJECT_INFO(CL_DEVICE_PINNED_HOST_BYTES_SNUCL, cl_ulong,
+                    pinned_host_bytes_);
+    GET_OBJECT_INFO(CL_DEVICE_PIN_CACHE_HIT_COUNT_SNUCL, cl_ulong,
+                    pin_cache_hits);
+    GET_OBJECT_INFO(CL_DEVICE_PIN_CACHE_MISS_COUNT_SNUCL, cl_ulong,
+                    pin_cache_misses);
+    GET_OBJECT_INFO(CL_DEVICE_PIN_CACHE_BYTES_SNUCL, cl_ulong,
+                    pin_cache_bytes);
+    GET_OBJECT_INFO(CL_DEVICE_LINE_CACHE_HIT_COUNT_SNUCL, cl_ulong,
+                    line_cache_hits);
+    GET_OBJECT_INFO(CL_DEVICE_LINE_CACHE_MISS_COUNT_SNUCL, cl_ulong,
+                    line_cache_misses);
+    default: return CL_INVALID_VALUE;
+  }
+  return CL_SUCCESS;
 }
 
 void OPAEDevice::FreeExecutable(CLProgram* program, void* executable) {
@@ -642,6 +1113,11 @@ bool OPAEDevice::PartialReconfig(CLKernel* kernel) {
   SNUCL_INFO("[PartialReconfig] start");
   OPAEBitstream* bitstream = (OPAEBitstream*)kernel->GetDevSpecific(this);
   fpga_result err = FPGA_OK;
+  // The accelerator handle is reopened, so no transfer may be in flight
+  pthread_mutex_lock(&mutex_dma_);
+  // Cached pins belong to the old handle
+  if (pin_cache_ != NULL)
+    pin_cache_->Clear(opae_handle_);
   err = fpgaClose(opae_handle_);
   CHECK_ERROR(err);
   {
@@ -657,6 +1133,7 @@ bool OPAEDevice::PartialReconfig(CLKernel* kernel) {
   CHECK_ERROR(err);
   err = fpgaReset(opae_handle_);
   CHECK_ERROR(err);
+  pthread_mutex_unlock(&mutex_dma_);
   SNUCL_INFO("[PartialReconfig] end");
 #endif
   return true;
@@ -682,7 +1159,7 @@ void OPAEDevice::SetKernelParam(CLKernel* kernel, cl_uint work_dim,
     CLMem* mem = it->second->mem;
     CLSampler* sampler = it->second->sampler;
     if (mem != NULL) {
-      void* ptr = mem->GetDevSpecific(this);
+      void* ptr = (void*)GetDevAddr(mem);
       if (args_size + sizeof(ptr) > 4096) {
         SNUCL_ERROR_EXIT("argument size out of range");
       }
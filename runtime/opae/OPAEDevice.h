@@ -41,12 +41,20 @@
 #ifndef __SNUCL__OPAE_DEVICE_H
 #define __SNUCL__OPAE_DEVICE_H
 
+#include <list>
 #include <map>
 #include <set>
 #include <string>
+#include <pthread.h>
 #include <CL/cl.h>
 #include "CLDevice.h"
 #include "CLKernel.h"
+#include "opae/OPAEDMAEngine.h"
+#include "opae/OPAELineCache.h"
+#include "opae/OPAEMemAllocator.h"
+#include "opae/OPAEPinCache.h"
+#include "opae/OPAETransfer.h"
+#include "opae/OPAEWriteFilter.h"
 #include <opae/fpga.h>
 
 class CLCommand;
@@ -130,6 +138,17 @@ class OPAEDevice: public CLDevice {
 
   virtual void* AllocMem(CLMem* mem);
   virtual void FreeMem(CLMem* mem, void* dev_specific);
+  virtual void* AllocMapPtr(CLMem* mem, size_t offset, size_t size);
+  virtual void FreeMapPtr(void* ptr);
+  virtual int GetMemBank(CLMem* mem);
+  virtual int GetNumMemBanks();
+  virtual void CompactMem();
+  virtual bool RegisterHostMem(void* ptr, size_t size);
+  virtual bool UnregisterHostMem(void* ptr);
+
+  virtual cl_int GetDeviceExtInfo(cl_device_info param_name,
+                                  size_t param_value_size, void* param_value,
+                                  size_t* param_value_size_ret);
 
   virtual void FreeExecutable(CLProgram* program, void* executable);
   virtual void* AllocKernel(CLKernel *kernel);
@@ -138,6 +157,8 @@ class OPAEDevice: public CLDevice {
  private:
   static const size_t LINE_SIZE = 64;
   static const size_t PAGE_SIZE = 4096;
+  static const size_t WRITE_FILTER_CHUNK_SIZE = 64 * 1024;
+  static const size_t COMPACTION_CHUNK_SIZE = 4 * 1024 * 1024;
 
   unsigned int BusyWait(uint64_t mmio_addr, unsigned int mask,
                         unsigned int wait_value, unsigned int interval);
@@ -146,10 +167,16 @@ class OPAEDevice: public CLDevice {
                       size_t gws[3], size_t lws[3], size_t nwg[3],
                       std::map<cl_uint, CLKernelArg*>* kernel_args);
   void* LoadBinary(CLProgram* program, const unsigned char* raw_binary);
-  void DMARead(size_t dev_addr, size_t host_addr, size_t num_lines);
-  void DMAWrite(size_t dev_addr, size_t host_addr, size_t num_lines);
   void ReadBufferImpl(size_t dev_addr, void* host_addr, size_t size);
   void WriteBufferImpl(size_t dev_addr, void* host_addr, size_t size);
+  void WriteBufferRange(size_t dev_addr, void* host_addr, size_t size);
+  size_t GetDevAddr(CLMem* mem);
+  int SelectMemBank(CLMem* mem);
+  bool EvictMem(int bank);
+  void CompactMemLocked();
+  void MoveMem(size_t src_addr, size_t dst_addr, size_t size);
+  bool GetPinnedIOAddress(size_t dev_addr, void* host_addr, size_t size,
+                          uint64_t* io_addr);
 
   fpga_token opae_device_token_;
   fpga_token opae_accelerator_token_;
@@ -160,8 +187,63 @@ class OPAEDevice: public CLDevice {
   char *opae_buffer_ptr_;
   uint64_t opae_buffer_addr_;
 
-  std::map<size_t, std::pair<size_t, bool>> mem_blocks_; // addr -> (size, is_free)
-  std::set<std::pair<size_t, size_t>> free_blocks_by_size_; // (size, addr)
+  // Pinned memory handed out by clEnqueueMapBuffer
+  uint64_t opae_map_pool_byte_;
+  char* opae_map_pool_ptr_;
+  uint64_t opae_map_pool_addr_;
+  std::map<size_t, size_t> map_pool_free_; // offset -> size
+  std::map<void*, std::pair<size_t, size_t>> map_pool_used_; // ptr -> (offset, size)
+  pthread_mutex_t mutex_map_pool_;
+
+  // Serializes DMA transfers issued from the copy lane and the kernel lane
+  pthread_mutex_t mutex_dma_;
+  // The shell's engine, or a host emulation of device memory if
+  // SNUCL_DMA_ENGINE is "software". Guarded by mutex_dma_.
+  OPAEDMAEngine* dma_engine_;
+
+  // Host memory registered by clRegisterHostMemory. Guarded by mutex_dma_.
+  struct OPAEHostRegion {
+    size_t size;
+    bool pinned; // transferred through the staging buffer if false
+    uint64_t wsid;
+    uint64_t io_addr;
+  };
+  std::map<char*, OPAEHostRegion> host_regions_;
+  cl_ulong pinned_host_bytes_;
+
+  // Pins recurring user ranges if SNUCL_PIN_CACHE_BUDGET is set. Guarded by
+  // mutex_dma_.
+  OPAEPinCache* pin_cache_;
+
+  // Partial lines of unaligned writes, unless SNUCL_LINE_CACHE_SIZE is 0.
+  // Guarded by mutex_dma_.
+  OPAELineCache* line_cache_;
+
+  // Staging, chunking, and partial lines of transfers through dma_engine_.
+  // Guarded by mutex_dma_.
+  OPAETransfer* transfer_;
+
+  // Skips uploads of unchanged chunks if SNUCL_WRITE_ELISION is set
+  OPAEWriteFilter* write_filter_;
+
+  int num_mem_banks_;
+  int next_mem_bank_; // for interleaved placement
+  OPAEMemAllocator* allocator_;
+
+  // Allocated memory objects in least recently used order
+  std::list<std::pair<CLMem*, size_t> > lru_mems_; // (mem, addr)
+  std::map<CLMem*, std::list<std::pair<CLMem*, size_t> >::iterator> lru_pos_;
+  cl_ulong num_evictions_;
+  cl_ulong evicted_bytes_;
+  cl_ulong num_refaults_;
+  pthread_mutex_t mutex_lru_;
+
+  // Moves idle buffers to close the gaps between live ones if
+  // SNUCL_MEM_COMPACTION is set
+  bool compaction_enabled_;
+  cl_ulong num_compactions_;
+  cl_ulong compacted_bytes_;
+  cl_ulong compaction_largest_[2]; // largest free block before and after
 
   int device_last_kernel_;
   std::map<CLProgram*, CLKernel*> all_kernel_;
@@ -0,0 +1,103 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#include "opae/OPAELineCache.h"
+#include <cassert>
+#include <cstring>
+#include <list>
+#include <map>
+#include <CL/cl.h>
+
+using namespace std;
+
+OPAELineCache::OPAELineCache(size_t capacity) {
+  capacity_ = capacity;
+  hits_ = 0;
+  misses_ = 0;
+}
+
+OPAELineCache::~OPAELineCache() {
+}
+
+bool OPAELineCache::Lookup(size_t addr, void* line) {
+  assert(addr % LINE_SIZE == 0);
+  LineMap::iterator it = lines_.find(addr);
+  if (it == lines_.end()) {
+    misses_++;
+    return false;
+  }
+  memcpy(line, it->second.data, LINE_SIZE);
+  lru_.splice(lru_.end(), lru_, it->second.lru_pos);
+  hits_++;
+  return true;
+}
+
+void OPAELineCache::Insert(size_t addr, const void* line) {
+  assert(addr % LINE_SIZE == 0);
+  if (capacity_ == 0)
+    return;
+  LineMap::iterator it = lines_.find(addr);
+  if (it != lines_.end()) {
+    lru_.splice(lru_.end(), lru_, it->second.lru_pos);
+  } else {
+    if (lines_.size() >= capacity_) {
+      lines_.erase(lru_.front());
+      lru_.pop_front();
+    }
+    it = lines_.insert(make_pair(addr, OPAELine())).first;
+    it->second.lru_pos = lru_.insert(lru_.end(), addr);
+  }
+  memcpy(it->second.data, line, LINE_SIZE);
+}
+
+void OPAELineCache::Invalidate(size_t addr, size_t size) {
+  if (size == 0)
+    return;
+  LineMap::iterator it = lines_.lower_bound(addr - addr % LINE_SIZE);
+  while (it != lines_.end() && it->first < addr + size) {
+    lru_.erase(it->second.lru_pos);
+    lines_.erase(it++);
+  }
+}
+
+void OPAELineCache::Clear() {
+  lines_.clear();
+  lru_.clear();
+}
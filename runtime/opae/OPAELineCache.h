@@ -0,0 +1,83 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SNUCL__OPAE_LINE_CACHE_H
+#define __SNUCL__OPAE_LINE_CACHE_H
+
+#include <list>
+#include <map>
+#include <stddef.h>
+#include <CL/cl.h>
+
+// Host copies of device memory lines at the edges of recent transfers. An
+// unaligned write takes its partial first and last lines from here instead
+// of reading them from the device. Anything else that writes device memory
+// must invalidate the lines it touches. Not thread-safe.
+class OPAELineCache {
+ public:
+  static const size_t LINE_SIZE = 64;
+
+  OPAELineCache(size_t capacity);
+  ~OPAELineCache();
+
+  // Copies the line at addr to line and returns true if it is cached
+  bool Lookup(size_t addr, void* line);
+  void Insert(size_t addr, const void* line);
+  void Invalidate(size_t addr, size_t size);
+  void Clear();
+
+  cl_ulong hits() const { return hits_; }
+  cl_ulong misses() const { return misses_; }
+
+ private:
+  struct OPAELine {
+    char data[LINE_SIZE];
+    std::list<size_t>::iterator lru_pos;
+  };
+  typedef std::map<size_t, OPAELine> LineMap;
+
+  size_t capacity_; // in lines
+  LineMap lines_;
+  std::list<size_t> lru_; // least recently used first
+  cl_ulong hits_;
+  cl_ulong misses_;
+};
+
+#endif // __SNUCL__OPAE_LINE_CACHE_H
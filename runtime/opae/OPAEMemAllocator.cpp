@@ -0,0 +1,640 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#include "opae/OPAEMemAllocator.h"
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+#include "Utils.h"
+
+using namespace std;
+
+const size_t OPAEMemHeap::UNIT_SIZE;
+const uint32_t OPAEMemHeap::NIL;
+const int8_t OPAEMemHeap::ORDER_USED;
+const int8_t OPAEMemHeap::ORDER_SLAB;
+const int OPAEMemAllocator::NUM_THREAD_SLOTS;
+const size_t OPAEMemAllocator::CACHE_CAPACITY;
+const size_t OPAEMemAllocator::CACHE_BATCH;
+
+OPAEMemHeap::OPAEMemHeap(size_t base, size_t size, size_t min_align) {
+  base_ = base;
+  num_units_ = size / UNIT_SIZE;
+  max_order_ = 0;
+  while (((uint64_t)2 << max_order_) <= num_units_)
+    max_order_++;
+
+  order_.assign(num_units_, ORDER_USED);
+  next_.assign(num_units_, NIL);
+  prev_.assign(num_units_, NIL);
+  free_head_.assign(max_order_ + 1, NIL);
+  slab_class_.assign(num_units_, -1);
+  free_bytes_ = 0;
+  FreeUnits(0, num_units_);
+
+  min_class_size_ = 1;
+  while (min_class_size_ < min_align)
+    min_class_size_ <<= 1;
+  num_classes_ = 0;
+  while ((min_class_size_ << num_classes_) <= UNIT_SIZE / 2)
+    num_classes_++;
+  partial_slabs_.assign(num_classes_, -1);
+  slab_free_bytes_ = 0;
+}
+
+OPAEMemHeap::~OPAEMemHeap() {
+}
+
+bool OPAEMemHeap::Alloc(size_t size, size_t* addr) {
+  if (size == 0) size = 1;
+  int size_class = GetSizeClass(size);
+  if (size_class >= 0)
+    return AllocSmall(size_class, addr);
+
+  uint32_t unit;
+  if (!AllocUnits((size + UNIT_SIZE - 1) / UNIT_SIZE, &unit))
+    return false;
+  *addr = base_ + (size_t)unit * UNIT_SIZE;
+  return true;
+}
+
+bool OPAEMemHeap::AllocRange(size_t addr, size_t size) {
+  uint32_t unit = (addr - base_) / UNIT_SIZE;
+  uint32_t end = unit + (size + UNIT_SIZE - 1) / UNIT_SIZE;
+  if (end > num_units_)
+    return false;
+  int order;
+  for (uint32_t u = unit; u < end; u += (1u << order)) {
+    u = GetFreeBlock(u, &order);
+    if (u == NIL)
+      return false;
+  }
+
+  // Take the free blocks overlapping the range and give back the parts
+  // outside of it
+  for (uint32_t u = unit; u < end;) {
+    uint32_t block = GetFreeBlock(u, &order);
+    uint32_t block_end = block + (1u << order);
+    RemoveFreeBlock(block, order);
+    free_bytes_ -= ((size_t)1 << order) * UNIT_SIZE;
+    if (block < unit)
+      FreeUnits(block, unit - block);
+    if (block_end > end)
+      FreeUnits(end, block_end - end);
+    u = block_end;
+  }
+  next_[unit] = end - unit;
+  return true;
+}
+
+size_t OPAEMemHeap::Free(size_t addr) {
+  uint32_t unit = (addr - base_) / UNIT_SIZE;
+  assert(unit < num_units_);
+  if (order_[unit] == ORDER_SLAB)
+    return FreeSmall(unit, addr);
+
+  assert(addr == base_ + (size_t)unit * UNIT_SIZE);
+  uint32_t num_units = next_[unit];
+  FreeUnits(unit, num_units);
+  return (size_t)num_units * UNIT_SIZE;
+}
+
+size_t OPAEMemHeap::GetFreeBytes() const {
+  return free_bytes_ + slab_free_bytes_;
+}
+
+size_t OPAEMemHeap::GetLargestFreeBlock() const {
+  for (int order = max_order_; order >= 0; order--) {
+    if (free_head_[order] != NIL)
+      return ((size_t)1 << order) * UNIT_SIZE;
+  }
+  for (int c = num_classes_ - 1; c >= 0; c--) {
+    if (partial_slabs_[c] >= 0)
+      return min_class_size_ << c;
+  }
+  return 0;
+}
+
+size_t OPAEMemHeap::GetFreeHead() const {
+  uint32_t unit = 0;
+  int order;
+  while (unit < num_units_) {
+    uint32_t block = GetFreeBlock(unit, &order);
+    if (block == NIL)
+      break;
+    unit = block + (1u << order);
+  }
+  return (size_t)unit * UNIT_SIZE;
+}
+
+size_t OPAEMemHeap::GetFreeTail() const {
+  uint32_t unit = num_units_;
+  int order;
+  while (unit > 0) {
+    uint32_t block = GetFreeBlock(unit - 1, &order);
+    if (block == NIL)
+      break;
+    unit = block;
+  }
+  return (size_t)(num_units_ - unit) * UNIT_SIZE;
+}
+
+bool OPAEMemHeap::AllocUnits(uint32_t num_units, uint32_t* unit) {
+  int order = 0;
+  while (((uint64_t)1 << order) < num_units)
+    order++;
+  int k = order;
+  while (k <= max_order_ && free_head_[k] == NIL)
+    k++;
+  if (k > max_order_)
+    return false;
+
+  uint32_t block = free_head_[k];
+  RemoveFreeBlock(block, k);
+  while (k > order) {
+    k--;
+    InsertFreeBlock(block + (1u << k), k);
+  }
+  free_bytes_ -= ((size_t)1 << order) * UNIT_SIZE;
+
+  // Give back the part of the block beyond the request
+  if (num_units < (1u << order))
+    FreeUnits(block + num_units, (1u << order) - num_units);
+
+  next_[block] = num_units;
+  *unit = block;
+  SNUCL_INFO("[OPAEMemAllocator] Allocated units [%u, %u)", block,
+             block + num_units);
+  return true;
+}
+
+void OPAEMemHeap::FreeUnits(uint32_t unit, uint32_t num_units) {
+  free_bytes_ += (size_t)num_units * UNIT_SIZE;
+  // Split the range into maximal aligned blocks
+  while (num_units > 0) {
+    int order = 0;
+    while (order < max_order_ &&
+           (unit & ((2u << order) - 1)) == 0 &&
+           (2u << order) <= num_units)
+      order++;
+    MergeFreeBlock(unit, order);
+    unit += (1u << order);
+    num_units -= (1u << order);
+  }
+}
+
+void OPAEMemHeap::InsertFreeBlock(uint32_t unit, int order) {
+  order_[unit] = order;
+  prev_[unit] = NIL;
+  next_[unit] = free_head_[order];
+  if (free_head_[order] != NIL)
+    prev_[free_head_[order]] = unit;
+  free_head_[order] = unit;
+}
+
+void OPAEMemHeap::RemoveFreeBlock(uint32_t unit, int order) {
+  if (prev_[unit] != NIL)
+    next_[prev_[unit]] = next_[unit];
+  else
+    free_head_[order] = next_[unit];
+  if (next_[unit] != NIL)
+    prev_[next_[unit]] = prev_[unit];
+  order_[unit] = ORDER_USED;
+}
+
+void OPAEMemHeap::MergeFreeBlock(uint32_t unit, int order) {
+  order_[unit] = ORDER_USED;
+  while (order < max_order_) {
+    uint32_t buddy = unit ^ (1u << order);
+    if ((uint64_t)buddy + (1u << order) > num_units_ || order_[buddy] != order)
+      break;
+    RemoveFreeBlock(buddy, order);
+    if (buddy < unit)
+      unit = buddy;
+    order++;
+  }
+  InsertFreeBlock(unit, order);
+}
+
+// Returns the free block containing the unit, or NIL if it is in use
+uint32_t OPAEMemHeap::GetFreeBlock(uint32_t unit, int* order) const {
+  for (int k = 0; k <= max_order_; k++) {
+    uint32_t block = unit & ~((1u << k) - 1);
+    if (order_[block] == k) {
+      *order = k;
+      return block;
+    }
+  }
+  return NIL;
+}
+
+int OPAEMemHeap::GetSizeClass(size_t size) const {
+  int size_class = 0;
+  while (size_class < num_classes_ && (min_class_size_ << size_class) < size)
+    size_class++;
+  return (size_class < num_classes_ ? size_class : -1);
+}
+
+int OPAEMemHeap::GetSlabClass(size_t addr) const {
+  return slab_class_[(addr - base_) / UNIT_SIZE];
+}
+
+bool OPAEMemHeap::AllocSmall(int size_class, size_t* addr) {
+  size_t class_size = min_class_size_ << size_class;
+  int s = partial_slabs_[size_class];
+  if (s < 0) {
+    uint32_t unit;
+    if (!AllocUnits(1, &unit))
+      return false;
+    if (unused_slabs_.empty()) {
+      s = slabs_.size();
+      slabs_.push_back(OPAESlab());
+    } else {
+      s = unused_slabs_.back();
+      unused_slabs_.pop_back();
+    }
+    OPAESlab& slab = slabs_[s];
+    slab.addr = base_ + (size_t)unit * UNIT_SIZE;
+    slab.size_class = size_class;
+    slab.num_objs = UNIT_SIZE / class_size;
+    slab.num_free = slab.num_objs;
+    slab.free_head = 0;
+    slab.next_free.resize(slab.num_objs);
+    for (int i = 0; i < slab.num_objs; i++)
+      slab.next_free[i] = i + 1;
+    slab.next_free[slab.num_objs - 1] = -1;
+    order_[unit] = ORDER_SLAB;
+    next_[unit] = s;
+    slab_class_[unit] = size_class;
+    slab_free_bytes_ += UNIT_SIZE;
+    LinkSlab(s);
+  }
+
+  OPAESlab& slab = slabs_[s];
+  int obj = slab.free_head;
+  slab.free_head = slab.next_free[obj];
+  if (--slab.num_free == 0)
+    UnlinkSlab(s);
+  slab_free_bytes_ -= class_size;
+  *addr = slab.addr + obj * class_size;
+  return true;
+}
+
+size_t OPAEMemHeap::FreeSmall(uint32_t unit, size_t addr) {
+  int s = next_[unit];
+  OPAESlab& slab = slabs_[s];
+  size_t class_size = min_class_size_ << slab.size_class;
+  int obj = (addr - slab.addr) / class_size;
+  slab.next_free[obj] = slab.free_head;
+  slab.free_head = obj;
+  if (slab.num_free++ == 0)
+    LinkSlab(s);
+  slab_free_bytes_ += class_size;
+
+  // Return an empty slab to the heap so that it can coalesce again
+  if (slab.num_free == slab.num_objs) {
+    UnlinkSlab(s);
+    slab_free_bytes_ -= UNIT_SIZE;
+    unused_slabs_.push_back(s);
+    order_[unit] = ORDER_USED;
+    slab_class_[unit] = -1;
+    FreeUnits(unit, 1);
+  }
+  return class_size;
+}
+
+void OPAEMemHeap::LinkSlab(int s) {
+  OPAESlab& slab = slabs_[s];
+  slab.prev = -1;
+  slab.next = partial_slabs_[slab.size_class];
+  if (slab.next >= 0)
+    slabs_[slab.next].prev = s;
+  partial_slabs_[slab.size_class] = s;
+}
+
+void OPAEMemHeap::UnlinkSlab(int s) {
+  OPAESlab& slab = slabs_[s];
+  if (slab.prev >= 0)
+    slabs_[slab.prev].next = slab.next;
+  else
+    partial_slabs_[slab.size_class] = slab.next;
+  if (slab.next >= 0)
+    slabs_[slab.next].prev = slab.prev;
+}
+
+static __thread int thread_slot = -1;
+static int next_thread_slot = 0;
+
+OPAEMemAllocator::OPAEMemAllocator(size_t base, size_t size,
+                                   size_t min_align, int num_shards) {
+  base_ = base;
+  num_shards_ = (num_shards > 0 ? num_shards : 1);
+  shard_size_ = size / num_shards_ / OPAEMemHeap::UNIT_SIZE *
+                OPAEMemHeap::UNIT_SIZE;
+  mutex_heaps_ = new pthread_mutex_t[num_shards_];
+  for (int i = 0; i < num_shards_; i++) {
+    heaps_.push_back(new OPAEMemHeap(base + i * shard_size_, shard_size_,
+                                     min_align));
+    pthread_mutex_init(&mutex_heaps_[i], NULL);
+  }
+
+  caches_ = new OPAEMemCache[NUM_THREAD_SLOTS];
+  for (int i = 0; i < NUM_THREAD_SLOTS; i++) {
+    pthread_mutex_init(&caches_[i].mutex, NULL);
+    caches_[i].objs.resize(heaps_[0]->num_classes());
+  }
+  pthread_mutex_init(&mutex_spans_, NULL);
+}
+
+OPAEMemAllocator::~OPAEMemAllocator() {
+  for (int i = 0; i < NUM_THREAD_SLOTS; i++)
+    pthread_mutex_destroy(&caches_[i].mutex);
+  delete[] caches_;
+  for (int i = 0; i < num_shards_; i++) {
+    delete heaps_[i];
+    pthread_mutex_destroy(&mutex_heaps_[i]);
+  }
+  delete[] mutex_heaps_;
+  pthread_mutex_destroy(&mutex_spans_);
+}
+
+bool OPAEMemAllocator::Alloc(size_t size, size_t* addr, int shard) {
+  if (size == 0) size = 1;
+  if (shard >= 0) {
+    // Placed in the given shard only, bypassing the caches
+    pthread_mutex_lock(&mutex_heaps_[shard]);
+    bool found = heaps_[shard]->Alloc(size, addr);
+    pthread_mutex_unlock(&mutex_heaps_[shard]);
+    return found;
+  }
+
+  int size_class = heaps_[0]->GetSizeClass(size);
+  if (size_class < 0)
+    return AllocLarge(size, addr) || AllocSpan(size, addr);
+
+  OPAEMemCache* cache = &caches_[GetThreadSlot()];
+  pthread_mutex_lock(&cache->mutex);
+  vector<size_t>& objs = cache->objs[size_class];
+  if (objs.empty())
+    RefillCache(cache, size_class);
+  bool found = !objs.empty();
+  if (found) {
+    *addr = objs.back();
+    objs.pop_back();
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return found;
+}
+
+// Places a large allocation at the given address if the whole range is free
+// and lies in a single shard
+bool OPAEMemAllocator::AllocAt(size_t addr, size_t size) {
+  if (heaps_[0]->GetSizeClass(size) >= 0)
+    return false;
+  int shard = GetShard(addr);
+  OPAEMemHeap* heap = heaps_[shard];
+  if (addr < heap->base() || addr + size > heap->base() + shard_size_)
+    return false;
+  pthread_mutex_lock(&mutex_heaps_[shard]);
+  bool found = heap->AllocRange(addr, size);
+  pthread_mutex_unlock(&mutex_heaps_[shard]);
+  return found;
+}
+
+void OPAEMemAllocator::Free(size_t addr) {
+  int size_class = heaps_[GetShard(addr)]->GetSlabClass(addr);
+  if (size_class < 0) {
+    FreeToShard(addr);
+    return;
+  }
+
+  OPAEMemCache* cache = &caches_[GetThreadSlot()];
+  pthread_mutex_lock(&cache->mutex);
+  cache->objs[size_class].push_back(addr);
+  if (cache->objs[size_class].size() >= CACHE_CAPACITY)
+    DrainCache(cache, size_class, CACHE_BATCH);
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+void OPAEMemAllocator::FlushCaches() {
+  for (int i = 0; i < NUM_THREAD_SLOTS; i++) {
+    OPAEMemCache* cache = &caches_[i];
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t c = 0; c < cache->objs.size(); c++)
+      DrainCache(cache, c, cache->objs[c].size());
+    pthread_mutex_unlock(&cache->mutex);
+  }
+}
+
+// Excludes the objects in the caches
+size_t OPAEMemAllocator::GetFreeBytes(int shard) {
+  pthread_mutex_lock(&mutex_heaps_[shard]);
+  size_t free_bytes = heaps_[shard]->GetFreeBytes();
+  pthread_mutex_unlock(&mutex_heaps_[shard]);
+  return free_bytes;
+}
+
+size_t OPAEMemAllocator::GetFreeBytes() {
+  size_t free_bytes = 0;
+  for (int i = 0; i < num_shards_; i++) {
+    pthread_mutex_lock(&mutex_heaps_[i]);
+    free_bytes += heaps_[i]->GetFreeBytes();
+    pthread_mutex_unlock(&mutex_heaps_[i]);
+  }
+  for (int i = 0; i < NUM_THREAD_SLOTS; i++) {
+    OPAEMemCache* cache = &caches_[i];
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t c = 0; c < cache->objs.size(); c++)
+      free_bytes += cache->objs[c].size() * heaps_[0]->GetClassSize(c);
+    pthread_mutex_unlock(&cache->mutex);
+  }
+  return free_bytes;
+}
+
+size_t OPAEMemAllocator::GetLargestFreeBlock() {
+  size_t largest = 0;
+  for (int i = 0; i < num_shards_; i++) {
+    pthread_mutex_lock(&mutex_heaps_[i]);
+    largest = max(largest, heaps_[i]->GetLargestFreeBlock());
+    pthread_mutex_unlock(&mutex_heaps_[i]);
+  }
+  return largest;
+}
+
+double OPAEMemAllocator::GetFragmentation() {
+  size_t free_bytes = GetFreeBytes();
+  if (free_bytes == 0)
+    return 0.0;
+  return 1.0 - (double)GetLargestFreeBlock() / free_bytes;
+}
+
+int OPAEMemAllocator::GetThreadSlot() {
+  if (thread_slot < 0)
+    thread_slot = __sync_fetch_and_add(&next_thread_slot, 1);
+  return thread_slot % NUM_THREAD_SLOTS;
+}
+
+int OPAEMemAllocator::GetShard(size_t addr) const {
+  int shard = (addr - base_) / shard_size_;
+  return min(shard, num_shards_ - 1);
+}
+
+bool OPAEMemAllocator::AllocLarge(size_t size, size_t* addr) {
+  // Try shards that are not busy first, starting from the thread's own one
+  int start = GetThreadSlot() % num_shards_;
+  for (int i = 0; i < num_shards_; i++) {
+    int shard = (start + i) % num_shards_;
+    if (pthread_mutex_trylock(&mutex_heaps_[shard]) != 0)
+      continue;
+    bool found = heaps_[shard]->Alloc(size, addr);
+    pthread_mutex_unlock(&mutex_heaps_[shard]);
+    if (found)
+      return true;
+  }
+  for (int i = 0; i < num_shards_; i++) {
+    int shard = (start + i) % num_shards_;
+    pthread_mutex_lock(&mutex_heaps_[shard]);
+    bool found = heaps_[shard]->Alloc(size, addr);
+    pthread_mutex_unlock(&mutex_heaps_[shard]);
+    if (found)
+      return true;
+  }
+  return false;
+}
+
+// Places the request on free space at the end of a shard and the beginning
+// of the following ones. Also catches free ranges that are large enough but
+// not aligned to a buddy block.
+bool OPAEMemAllocator::AllocSpan(size_t size, size_t* addr) {
+  bool found = false;
+  for (int i = 0; i < num_shards_; i++)
+    pthread_mutex_lock(&mutex_heaps_[i]);
+  for (int first = 0; first < num_shards_ && !found; first++) {
+    size_t tail = heaps_[first]->GetFreeTail();
+    if (tail == 0)
+      continue;
+    size_t start = heaps_[first]->base() + shard_size_ - tail;
+    size_t avail = tail;
+    int last = first;
+    while (avail < size && last + 1 < num_shards_) {
+      last++;
+      size_t head = heaps_[last]->GetFreeHead();
+      avail += head;
+      if (head < shard_size_)
+        break;
+    }
+    if (avail < size)
+      continue;
+
+    size_t end = start + size;
+    for (int i = first; i <= last; i++) {
+      size_t from = max(start, heaps_[i]->base());
+      size_t to = min(end, heaps_[i]->base() + shard_size_);
+      heaps_[i]->AllocRange(from, to - from);
+    }
+    if (last > first) {
+      pthread_mutex_lock(&mutex_spans_);
+      spans_[start] = size;
+      pthread_mutex_unlock(&mutex_spans_);
+    }
+    *addr = start;
+    found = true;
+  }
+  for (int i = num_shards_ - 1; i >= 0; i--)
+    pthread_mutex_unlock(&mutex_heaps_[i]);
+  return found;
+}
+
+void OPAEMemAllocator::FreeToShard(size_t addr) {
+  int shard = GetShard(addr);
+  pthread_mutex_lock(&mutex_heaps_[shard]);
+  size_t freed = heaps_[shard]->Free(addr);
+  pthread_mutex_unlock(&mutex_heaps_[shard]);
+  if (addr + freed != heaps_[shard]->base() + shard_size_)
+    return;
+
+  // The allocation may continue in the following shards
+  pthread_mutex_lock(&mutex_spans_);
+  map<size_t, size_t>::iterator it = spans_.find(addr);
+  size_t end = 0;
+  if (it != spans_.end()) {
+    end = addr + it->second;
+    spans_.erase(it);
+  }
+  pthread_mutex_unlock(&mutex_spans_);
+  for (int i = shard + 1; i < num_shards_ && heaps_[i]->base() < end; i++) {
+    pthread_mutex_lock(&mutex_heaps_[i]);
+    heaps_[i]->Free(heaps_[i]->base());
+    pthread_mutex_unlock(&mutex_heaps_[i]);
+  }
+}
+
+// Called with the cache locked
+void OPAEMemAllocator::RefillCache(OPAEMemCache* cache, int size_class) {
+  vector<size_t>& objs = cache->objs[size_class];
+  size_t class_size = heaps_[0]->GetClassSize(size_class);
+  int start = GetThreadSlot() % num_shards_;
+  for (int i = 0; i < num_shards_ && objs.empty(); i++) {
+    int shard = (start + i) % num_shards_;
+    pthread_mutex_lock(&mutex_heaps_[shard]);
+    size_t addr;
+    while (objs.size() < CACHE_BATCH &&
+           heaps_[shard]->Alloc(class_size, &addr))
+      objs.push_back(addr);
+    pthread_mutex_unlock(&mutex_heaps_[shard]);
+  }
+}
+
+// Called with the cache locked. Returns the objects cached the longest.
+void OPAEMemAllocator::DrainCache(OPAEMemCache* cache, int size_class,
+                                  size_t count) {
+  vector<size_t>& objs = cache->objs[size_class];
+  for (size_t i = 0; i < count; i++) {
+    int shard = GetShard(objs[i]);
+    pthread_mutex_lock(&mutex_heaps_[shard]);
+    heaps_[shard]->Free(objs[i]);
+    pthread_mutex_unlock(&mutex_heaps_[shard]);
+  }
+  objs.erase(objs.begin(), objs.begin() + count);
+}
@@ -0,0 +1,184 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#ifndef __SNUCL__OPAE_MEM_ALLOCATOR_H
+#define __SNUCL__OPAE_MEM_ALLOCATOR_H
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <pthread.h>
+
+// A device memory range. Large requests are served by a buddy heap of 64KB
+// units whose unused tail is given back, and small requests by slabs of
+// power-of-two size classes carved out of single units. Not thread-safe.
+class OPAEMemHeap {
+ public:
+  OPAEMemHeap(size_t base, size_t size, size_t min_align);
+  ~OPAEMemHeap();
+
+  bool Alloc(size_t size, size_t* addr);
+  bool AllocRange(size_t addr, size_t size);
+  size_t Free(size_t addr);
+
+  size_t base() const { return base_; }
+  size_t size() const { return (size_t)num_units_ * UNIT_SIZE; }
+  int num_classes() const { return num_classes_; }
+  int GetSizeClass(size_t size) const;
+  int GetSlabClass(size_t addr) const;
+  size_t GetClassSize(int size_class) const {
+    return min_class_size_ << size_class;
+  }
+
+  size_t GetFreeBytes() const;
+  size_t GetLargestFreeBlock() const;
+  size_t GetFreeHead() const;
+  size_t GetFreeTail() const;
+
+  static const size_t UNIT_SIZE = 64 * 1024;
+
+ private:
+  struct OPAESlab {
+    size_t addr;
+    int size_class;
+    int num_objs;
+    int num_free;
+    int free_head;
+    int prev; // partial slab list
+    int next;
+    std::vector<int> next_free;
+  };
+
+  bool AllocUnits(uint32_t num_units, uint32_t* unit);
+  void FreeUnits(uint32_t unit, uint32_t num_units);
+  void InsertFreeBlock(uint32_t unit, int order);
+  void RemoveFreeBlock(uint32_t unit, int order);
+  void MergeFreeBlock(uint32_t unit, int order);
+  uint32_t GetFreeBlock(uint32_t unit, int* order) const;
+
+  bool AllocSmall(int size_class, size_t* addr);
+  size_t FreeSmall(uint32_t unit, size_t addr);
+  void LinkSlab(int slab);
+  void UnlinkSlab(int slab);
+
+  static const uint32_t NIL = 0xFFFFFFFF;
+  static const int8_t ORDER_USED = -1; // allocated or inside a block
+  static const int8_t ORDER_SLAB = -2; // first unit of a slab
+
+  size_t base_;
+  uint32_t num_units_;
+  int max_order_;
+
+  // Per-unit state. For the first unit of a free block, order_ is the order
+  // of the block and next_/prev_ link the free list of that order. For the
+  // first unit of an allocation, next_ is its length in units, or the slab
+  // index if order_ is ORDER_SLAB.
+  std::vector<int8_t> order_;
+  std::vector<uint32_t> next_;
+  std::vector<uint32_t> prev_;
+  std::vector<uint32_t> free_head_; // per order
+  // Size class of each slab unit, or -1. Stays unchanged while any object of
+  // the slab is allocated, so the owner of an object may read it unlocked.
+  std::vector<int8_t> slab_class_;
+  size_t free_bytes_;
+
+  size_t min_class_size_;
+  int num_classes_;
+  std::vector<OPAESlab> slabs_;
+  std::vector<int> unused_slabs_;
+  std::vector<int> partial_slabs_; // per size class
+  size_t slab_free_bytes_;
+};
+
+// Thread-safe front end. Device memory is split into shards, each guarded by
+// its own lock, and freed small objects are kept in per-thread caches so that
+// most small allocations take no shared lock at all.
+class OPAEMemAllocator {
+ public:
+  OPAEMemAllocator(size_t base, size_t size, size_t min_align,
+                   int num_shards);
+  ~OPAEMemAllocator();
+
+  bool Alloc(size_t size, size_t* addr, int shard = -1);
+  bool AllocAt(size_t addr, size_t size);
+  void Free(size_t addr);
+  void FlushCaches();
+
+  int num_shards() const { return num_shards_; }
+  size_t shard_size() const { return shard_size_; }
+  int GetShard(size_t addr) const;
+  size_t GetShardBase(int shard) const { return heaps_[shard]->base(); }
+  size_t GetFreeBytes(int shard);
+  size_t GetFreeBytes();
+  size_t GetLargestFreeBlock();
+  double GetFragmentation();
+
+ private:
+  struct OPAEMemCache {
+    pthread_mutex_t mutex;
+    std::vector<std::vector<size_t> > objs; // per size class
+  };
+
+  int GetThreadSlot();
+  bool AllocLarge(size_t size, size_t* addr);
+  bool AllocSpan(size_t size, size_t* addr);
+  void FreeToShard(size_t addr);
+  void RefillCache(OPAEMemCache* cache, int size_class);
+  void DrainCache(OPAEMemCache* cache, int size_class, size_t count);
+
+  static const int NUM_THREAD_SLOTS = 64;
+  static const size_t CACHE_CAPACITY = 32;
+  static const size_t CACHE_BATCH = 16;
+
+  size_t base_;
+  size_t shard_size_;
+  int num_shards_;
+  std::vector<OPAEMemHeap*> heaps_;
+  pthread_mutex_t* mutex_heaps_;
+  OPAEMemCache* caches_;
+
+  // Allocations that cross shard boundaries (addr -> size)
+  std::map<size_t, size_t> spans_;
+  pthread_mutex_t mutex_spans_;
+};
+
+#endif // __SNUCL__OPAE_MEM_ALLOCATOR_H
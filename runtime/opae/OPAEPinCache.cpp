@@ -0,0 +1,192 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#include "opae/OPAEPinCache.h"
+#include <list>
+#include <map>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <CL/cl.h>
+#include "Utils.h"
+#include <opae/fpga.h>
+
+using namespace std;
+
+// A /proc/self/pagemap entry has the frame number in bits 0-54 and the
+// present bit in bit 63
+#define PAGEMAP_FRAME_MASK ((1ULL << 55) - 1)
+#define PAGEMAP_PRESENT (1ULL << 63)
+
+OPAEPinCache::OPAEPinCache(size_t budget) {
+  budget_ = budget;
+  page_size_ = (size_t)getpagesize();
+  pagemap_fd_ = open("/proc/self/pagemap", O_RDONLY);
+  if (pagemap_fd_ < 0) {
+    SNUCL_INFO("%s", "[OPAEPinCache] Disabled; cannot read the page map");
+    budget_ = 0;
+  } else {
+    // Frame numbers read as zero without CAP_SYS_ADMIN, so remapped pages
+    // could not be told apart. The page holding this object is present.
+    char* page = (char*)((size_t)this / page_size_ * page_size_);
+    vector<uint64_t> frames;
+    if (!ReadFrames(page, page_size_, frames) || frames[0] == 0) {
+      SNUCL_INFO("%s", "[OPAEPinCache] Disabled; page frame numbers are "
+                       "hidden");
+      close(pagemap_fd_);
+      pagemap_fd_ = -1;
+      budget_ = 0;
+    }
+  }
+  hits_ = 0;
+  misses_ = 0;
+  pinned_bytes_ = 0;
+}
+
+OPAEPinCache::~OPAEPinCache() {
+  if (pagemap_fd_ >= 0)
+    close(pagemap_fd_);
+}
+
+bool OPAEPinCache::Lookup(fpga_handle handle, char* ptr, size_t size,
+                          uint64_t* io_addr) {
+  if (size < MIN_SIZE || budget_ == 0)
+    return false;
+
+  EntryMap::iterator it = entries_.upper_bound(ptr);
+  if (it != entries_.begin()) {
+    --it;
+    if (ptr + size <= it->first + it->second.size) {
+      vector<uint64_t> frames;
+      if (ReadFrames(it->first, it->second.size, frames) &&
+          frames == it->second.frames) {
+        hits_++;
+        lru_.splice(lru_.end(), lru_, it->second.lru_pos);
+        *io_addr = it->second.io_addr + (ptr - it->first);
+        return true;
+      }
+      SNUCL_INFO("[OPAEPinCache] Range %p has been remapped", it->first);
+      Unpin(handle, it);
+    }
+  }
+  misses_++;
+
+  // Only ranges that come again are pinned
+  char* first = (char*)((size_t)ptr / page_size_ * page_size_);
+  char* last = (char*)(((size_t)ptr + size + page_size_ - 1) / page_size_ *
+                       page_size_);
+  map<char*, size_t>::iterator candidate = candidates_.find(first);
+  if (candidate == candidates_.end() ||
+      candidate->second != (size_t)(last - first)) {
+    if (candidates_.size() >= MAX_CANDIDATES)
+      candidates_.clear();
+    candidates_[first] = last - first;
+    return false;
+  }
+  candidates_.erase(candidate);
+  if (!Pin(handle, first, last - first))
+    return false;
+  *io_addr = entries_[first].io_addr + (ptr - first);
+  return true;
+}
+
+void OPAEPinCache::Clear(fpga_handle handle) {
+  while (!entries_.empty())
+    Unpin(handle, entries_.begin());
+}
+
+bool OPAEPinCache::Pin(fpga_handle handle, char* first, size_t size) {
+  if (size > budget_)
+    return false;
+  // Drop the ranges it overlaps and make room
+  EntryMap::iterator it = entries_.lower_bound(first);
+  if (it != entries_.begin() &&
+      prev(it)->first + prev(it)->second.size > first)
+    --it;
+  while (it != entries_.end() && it->first < first + size)
+    Unpin(handle, it++);
+  while (pinned_bytes_ + size > budget_)
+    Unpin(handle, entries_.find(lru_.front()));
+
+  OPAEPinEntry entry;
+  entry.size = size;
+  void* buf_addr = first;
+  fpga_result err = fpgaPrepareBuffer(handle, size, &buf_addr, &entry.wsid,
+                                      FPGA_BUF_PREALLOCATED);
+  if (err != FPGA_OK) {
+    SNUCL_INFO("[OPAEPinCache] Cannot pin 0x%zX bytes at %p: %s", size,
+               first, fpgaErrStr(err));
+    return false;
+  }
+  if (fpgaGetIOAddress(handle, entry.wsid, &entry.io_addr) != FPGA_OK ||
+      !ReadFrames(first, size, entry.frames) || entry.frames[0] == 0) {
+    fpgaReleaseBuffer(handle, entry.wsid);
+    return false;
+  }
+  entry.lru_pos = lru_.insert(lru_.end(), first);
+  entries_[first] = entry;
+  pinned_bytes_ += size;
+  return true;
+}
+
+void OPAEPinCache::Unpin(fpga_handle handle, EntryMap::iterator it) {
+  fpgaReleaseBuffer(handle, it->second.wsid);
+  pinned_bytes_ -= it->second.size;
+  lru_.erase(it->second.lru_pos);
+  entries_.erase(it);
+}
+
+// Fails if any page is not present
+bool OPAEPinCache::ReadFrames(char* first, size_t size,
+                              vector<uint64_t>& frames) {
+  size_t num_pages = size / page_size_;
+  frames.resize(num_pages);
+  size_t bytes = num_pages * sizeof(uint64_t);
+  off_t offset = (off_t)((size_t)first / page_size_ * sizeof(uint64_t));
+  if (pread(pagemap_fd_, frames.data(), bytes, offset) != (ssize_t)bytes)
+    return false;
+  for (size_t i = 0; i < num_pages; i++) {
+    if (!(frames[i] & PAGEMAP_PRESENT))
+      return false;
+    frames[i] &= PAGEMAP_FRAME_MASK;
+  }
+  return true;
+}
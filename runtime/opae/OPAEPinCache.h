@@ -0,0 +1,101 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SNUCL__OPAE_PIN_CACHE_H
+#define __SNUCL__OPAE_PIN_CACHE_H
+
+#include <list>
+#include <map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <CL/cl.h>
+#include <opae/fpga.h>
+
+// Pins user ranges that are transferred again and again so that they are
+// DMAed directly, up to a budget of pinned bytes. The least recently used
+// ranges are unpinned first. A range is used only while its pages are still
+// the ones that were pinned, which catches memory that was freed and mapped
+// again. Not thread-safe.
+class OPAEPinCache {
+ public:
+  OPAEPinCache(size_t budget);
+  ~OPAEPinCache();
+
+  // Returns true with the IO address of ptr if the whole range is pinned
+  bool Lookup(fpga_handle handle, char* ptr, size_t size, uint64_t* io_addr);
+  void Clear(fpga_handle handle);
+
+  // False if pinned pages cannot be validated, in which case nothing is
+  // ever pinned
+  bool enabled() const { return budget_ > 0; }
+  cl_ulong hits() const { return hits_; }
+  cl_ulong misses() const { return misses_; }
+  cl_ulong pinned_bytes() const { return pinned_bytes_; }
+
+ private:
+  struct OPAEPinEntry {
+    size_t size;
+    uint64_t wsid;
+    uint64_t io_addr;
+    std::vector<uint64_t> frames;
+    std::list<char*>::iterator lru_pos;
+  };
+  typedef std::map<char*, OPAEPinEntry> EntryMap;
+
+  bool Pin(fpga_handle handle, char* first, size_t size);
+  void Unpin(fpga_handle handle, EntryMap::iterator it);
+  bool ReadFrames(char* first, size_t size, std::vector<uint64_t>& frames);
+
+  static const size_t MIN_SIZE = 1024 * 1024;
+  static const size_t MAX_CANDIDATES = 64;
+
+  size_t budget_;
+  size_t page_size_;
+  int pagemap_fd_;
+  EntryMap entries_; // first page -> entry
+  std::list<char*> lru_; // least recently used first
+  std::map<char*, size_t> candidates_; // ranges seen once (first -> size)
+  cl_ulong hits_;
+  cl_ulong misses_;
+  cl_ulong pinned_bytes_;
+};
+
+#endif // __SNUCL__OPAE_PIN_CACHE_H
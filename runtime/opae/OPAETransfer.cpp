@@ -0,0 +1,264 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#include "opae/OPAETransfer.h"
+#include <algorithm>
+#include <cassert>
+#include <stdint.h>
+#include "CLMemcpyPool.h"
+#include "Utils.h"
+
+using namespace std;
+
+OPAETransfer::OPAETransfer(OPAEDMAEngine* engine, char* staging_ptr,
+                           uint64_t staging_addr, size_t staging_size,
+                           OPAELineCache* line_cache) {
+  engine_ = engine;
+  staging_ptr_ = staging_ptr;
+  staging_addr_ = staging_addr;
+  slot_size_ = min((size_t)MAX_SLOT_SIZE, staging_size / NUM_SLOTS);
+  slot_size_ -= slot_size_ % LINE_SIZE;
+  max_lines_ = staging_size / LINE_SIZE;
+  line_cache_ = line_cache;
+  assert(slot_size_ > 0);
+}
+
+void OPAETransfer::Read(size_t dev_addr, void* host_addr, size_t size) {
+  if (size > 0)
+    ReadStaged(dev_addr, host_addr, size);
+}
+
+void OPAETransfer::Write(size_t dev_addr, void* host_addr, size_t size) {
+  if (size > 0)
+    WriteStaged(dev_addr, host_addr, size);
+}
+
+// Only whole lines are transferred directly so that the bytes around the
+// requested range are left untouched. host_addr and dev_addr must be at the
+// same offset within a line.
+void OPAETransfer::ReadPinned(size_t dev_addr, void* host_addr,
+                              uint64_t io_addr, size_t size) {
+  size_t head = (LINE_SIZE - dev_addr % LINE_SIZE) % LINE_SIZE;
+  if (head > size) head = size;
+  size_t num_lines = (size - head) / LINE_SIZE;
+  size_t tail = size - head - num_lines * LINE_SIZE;
+  SNUCL_INFO("[ReadPinned] Direct DMA to pinned memory(0x%zX)", host_addr);
+  if (head > 0)
+    ReadStaged(dev_addr, host_addr, head);
+  if (num_lines > 0)
+    ReadDirect(dev_addr + head, io_addr + head, num_lines);
+  if (tail > 0)
+    ReadStaged(dev_addr + size - tail, (char*)host_addr + size - tail, tail);
+}
+
+// Partial lines at both ends need a read-modify-write through the staging
+// buffer
+void OPAETransfer::WritePinned(size_t dev_addr, void* host_addr,
+                               uint64_t io_addr, size_t size) {
+  size_t head = (LINE_SIZE - dev_addr % LINE_SIZE) % LINE_SIZE;
+  if (head > size) head = size;
+  size_t num_lines = (size - head) / LINE_SIZE;
+  size_t tail = size - head - num_lines * LINE_SIZE;
+  SNUCL_INFO("[WritePinned] Direct DMA from pinned memory(0x%zX)", host_addr);
+  if (head > 0)
+    WriteStaged(dev_addr, host_addr, head);
+  if (num_lines > 0)
+    WriteDirect(dev_addr + head, io_addr + head, num_lines);
+  if (tail > 0)
+    WriteStaged(dev_addr + size - tail, (char*)host_addr + size - tail, tail);
+}
+
+// StartRead() and StartWrite() queue a transfer on the engine and return its
+// ticket. Transfers complete in the order they are started.
+uint64_t OPAETransfer::StartRead(size_t dev_addr, uint64_t host_addr,
+                                 size_t num_lines) {
+  SNUCL_INFO("[DMARead] Will copy 0x%zX lines from device memory(0x%zX) to buffer(pa=0x%zX)", num_lines, dev_addr, host_addr);
+  assert(dev_addr % LINE_SIZE == 0);
+  assert(host_addr % LINE_SIZE == 0);
+  assert(num_lines <= max_lines_);
+  OPAEDMADescriptor desc = {false, dev_addr, host_addr, num_lines};
+  return engine_->Submit(desc);
+}
+
+uint64_t OPAETransfer::StartWrite(size_t dev_addr, uint64_t host_addr,
+                                  size_t num_lines) {
+  SNUCL_INFO("[DMAWrite] Will copy 0x%zX lines from buffer(pa=0x%zX) to device memory(0x%zX)", num_lines, host_addr, dev_addr);
+  assert(dev_addr % LINE_SIZE == 0);
+  assert(host_addr % LINE_SIZE == 0);
+  assert(num_lines <= max_lines_);
+  OPAEDMADescriptor desc = {true, dev_addr, host_addr, num_lines};
+  uint64_t ticket = engine_->Submit(desc);
+  if (line_cache_ != NULL)
+    line_cache_->Invalidate(dev_addr, num_lines * LINE_SIZE);
+  return ticket;
+}
+
+// The staging buffer is split into slots so that the copy between a slot
+// and the user memory overlaps the DMA of the next chunks to or from the
+// other slots. A slot is reused once the transfer that last used it is done.
+void OPAETransfer::ReadStaged(size_t dev_addr, void* host_addr,
+                              size_t size) {
+  size_t first_line = dev_addr / LINE_SIZE;
+  size_t end_line = (dev_addr + size - 1) / LINE_SIZE + 1;
+  size_t slot_lines = slot_size_ / LINE_SIZE;
+  size_t num_chunks = (end_line - first_line + slot_lines - 1) / slot_lines;
+
+  SNUCL_INFO("[ReadStaged] Will copy 0x%zX bytes from device memory(0x%zX) to user memory(0x%zX)", size, dev_addr, host_addr);
+  uint64_t tickets[NUM_SLOTS];
+  for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+    // Keeps every slot busy ahead of the chunk being copied out
+    for (size_t ahead = (chunk == 0 ? 0 : chunk + NUM_SLOTS - 1);
+         ahead < num_chunks && ahead < chunk + NUM_SLOTS;
+         ahead++) {
+      size_t line = first_line + ahead * slot_lines;
+      int slot = ahead % NUM_SLOTS;
+      tickets[slot] = StartRead(line * LINE_SIZE,
+                                staging_addr_ + slot * slot_size_,
+                                min(slot_lines, end_line - line));
+    }
+
+    size_t line = first_line + chunk * slot_lines;
+    size_t lines_now = min(slot_lines, end_line - line);
+    int slot = chunk % NUM_SLOTS;
+    char* slot_ptr = staging_ptr_ + slot * slot_size_;
+    engine_->Wait(tickets[slot]);
+    size_t skip = (chunk == 0 ? dev_addr % LINE_SIZE : 0);
+    size_t bytes_now = min(lines_now * LINE_SIZE - skip, size);
+    if (line_cache_ != NULL) {
+      if (skip != 0)
+        line_cache_->Insert(line * LINE_SIZE, slot_ptr);
+      if ((skip + bytes_now) % LINE_SIZE != 0)
+        line_cache_->Insert((line + lines_now - 1) * LINE_SIZE,
+                            slot_ptr + (lines_now - 1) * LINE_SIZE);
+    }
+    CLMemcpyPool::GetPool()->Copy(host_addr, slot_ptr + skip, bytes_now);
+    host_addr = (char*)host_addr + bytes_now;
+    size -= bytes_now;
+  }
+  SNUCL_INFO("[ReadStaged] Done");
+}
+
+void OPAETransfer::WriteStaged(size_t dev_addr, void* host_addr,
+                               size_t size) {
+  size_t first_line = dev_addr / LINE_SIZE;
+  size_t end_line = (dev_addr + size - 1) / LINE_SIZE + 1;
+  size_t slot_lines = slot_size_ / LINE_SIZE;
+
+  SNUCL_INFO("[WriteStaged] Will copy 0x%zX bytes from user memory(0x%zX) to device memory(0x%zX)", size, host_addr, dev_addr);
+  uint64_t tickets[NUM_SLOTS];
+  uint64_t last_ticket = 0;
+  size_t chunk = 0;
+  for (size_t line = first_line; line < end_line; chunk++) {
+    size_t lines_now = min(slot_lines, end_line - line);
+    int slot = chunk % NUM_SLOTS;
+    char* slot_ptr = staging_ptr_ + slot * slot_size_;
+    uint64_t slot_addr = staging_addr_ + slot * slot_size_;
+    if (chunk >= NUM_SLOTS)
+      engine_->Wait(tickets[slot]);
+    size_t skip = (chunk == 0 ? dev_addr % LINE_SIZE : 0);
+    size_t bytes_now = min(lines_now * LINE_SIZE - skip, size);
+    // Partial lines not in the line cache are read first. The read queues
+    // behind the writes in flight, which cover other lines.
+    bool head_partial = (skip != 0);
+    bool tail_partial = ((skip + bytes_now) % LINE_SIZE != 0);
+    if (head_partial) {
+      SNUCL_INFO("[WriteStaged] First byte is unaligned (0x%zX)", dev_addr);
+      ReadPartialLine(line * LINE_SIZE, slot_ptr, slot_addr);
+    }
+    if (tail_partial && !(head_partial && lines_now == 1)) {
+      SNUCL_INFO("[WriteStaged] Last byte is unaligned (0x%zX)", dev_addr + size - 1);
+      ReadPartialLine((line + lines_now - 1) * LINE_SIZE,
+                      slot_ptr + (lines_now - 1) * LINE_SIZE,
+                      slot_addr + (lines_now - 1) * LINE_SIZE);
+    }
+    // The host never reads the staging buffer back
+    CLMemcpyPool::GetPool()->Copy(slot_ptr + skip, host_addr, bytes_now,
+                                  true);
+    tickets[slot] = last_ticket =
+        StartWrite(line * LINE_SIZE, slot_addr, lines_now);
+    if (line_cache_ != NULL) {
+      if (head_partial)
+        line_cache_->Insert(line * LINE_SIZE, slot_ptr);
+      if (tail_partial)
+        line_cache_->Insert((line + lines_now - 1) * LINE_SIZE,
+                            slot_ptr + (lines_now - 1) * LINE_SIZE);
+    }
+    line += lines_now;
+    host_addr = (char*)host_addr + bytes_now;
+    size -= bytes_now;
+  }
+  engine_->Wait(last_ticket);
+  SNUCL_INFO("[WriteStaged] Done");
+}
+
+// Fills a staging line with the current contents of a device line
+void OPAETransfer::ReadPartialLine(size_t dev_addr, char* line_ptr,
+                                   uint64_t line_addr) {
+  if (line_cache_ != NULL && line_cache_->Lookup(dev_addr, line_ptr))
+    return;
+  engine_->Wait(StartRead(dev_addr, line_addr, 1));
+}
+
+// Every chunk is queued at once, and only the last one is waited for
+void OPAETransfer::ReadDirect(size_t dev_addr, uint64_t io_addr,
+                              size_t num_lines) {
+  uint64_t ticket = 0;
+  while (num_lines > 0) {
+    size_t lines_now = min(max_lines_, num_lines);
+    ticket = StartRead(dev_addr, io_addr, lines_now);
+    dev_addr += lines_now * LINE_SIZE;
+    io_addr += lines_now * LINE_SIZE;
+    num_lines -= lines_now;
+  }
+  engine_->Wait(ticket);
+}
+
+void OPAETransfer::WriteDirect(size_t dev_addr, uint64_t io_addr,
+                               size_t num_lines) {
+  uint64_t ticket = 0;
+  while (num_lines > 0) {
+    size_t lines_now = min(max_lines_, num_lines);
+    ticket = StartWrite(dev_addr, io_addr, lines_now);
+    dev_addr += lines_now * LINE_SIZE;
+    io_addr += lines_now * LINE_SIZE;
+    num_lines -= lines_now;
+  }
+  engine_->Wait(ticket);
+}
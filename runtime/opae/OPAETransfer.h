@@ -0,0 +1,91 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+#ifndef __SNUCL__OPAE_TRANSFER_H
+#define __SNUCL__OPAE_TRANSFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "opae/OPAEDMAEngine.h"
+#include "opae/OPAELineCache.h"
+
+// Copies byte ranges between device memory and user memory with a DMA
+// engine. A range that is not pinned goes through a pinned staging buffer,
+// and the bytes around a written range that share its first or last line
+// keep their contents. Not thread-safe.
+class OPAETransfer {
+ public:
+  // staging_ptr is pinned at IO address staging_addr. Written lines are
+  // invalidated in line_cache, which may be NULL.
+  OPAETransfer(OPAEDMAEngine* engine, char* staging_ptr,
+               uint64_t staging_addr, size_t staging_size,
+               OPAELineCache* line_cache = NULL);
+
+  void Read(size_t dev_addr, void* host_addr, size_t size);
+  void Write(size_t dev_addr, void* host_addr, size_t size);
+  // host_addr is pinned at IO address io_addr
+  void ReadPinned(size_t dev_addr, void* host_addr, uint64_t io_addr,
+                  size_t size);
+  void WritePinned(size_t dev_addr, void* host_addr, uint64_t io_addr,
+                   size_t size);
+
+  static const size_t LINE_SIZE = OPAEDMAEngine::LINE_SIZE;
+
+ private:
+  static const size_t MAX_SLOT_SIZE = 8 * 1024 * 1024;
+  static const int NUM_SLOTS = 4;
+
+  uint64_t StartRead(size_t dev_addr, uint64_t host_addr, size_t num_lines);
+  uint64_t StartWrite(size_t dev_addr, uint64_t host_addr, size_t num_lines);
+  void ReadStaged(size_t dev_addr, void* host_addr, size_t size);
+  void WriteStaged(size_t dev_addr, void* host_addr, size_t size);
+  void ReadDirect(size_t dev_addr, uint64_t io_addr, size_t num_lines);
+  void WriteDirect(size_t dev_addr, uint64_t io_addr, size_t num_lines);
+  void ReadPartialLine(size_t dev_addr, char* line_ptr, uint64_t line_addr);
+
+  OPAEDMAEngine* engine_;
+  char* staging_ptr_;
+  uint64_t staging_addr_;
+  size_t slot_size_;
+  size_t max_lines_; // in one transfer
+  OPAELineCache* line_cache_;
+};
+
+#endif // __SNUCL__OPAE_TRANSFER_H
@@ -0,0 +1,222 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#include "opae/OPAEWriteFilter.h"
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+using namespace std;
+
+OPAEWriteFilter::OPAEWriteFilter(size_t chunk_size) {
+  chunk_size_ = chunk_size;
+  elided_bytes_ = 0;
+  hashed_bytes_ = 0;
+  hash_time_ = 0;
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+OPAEWriteFilter::~OPAEWriteFilter() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+void OPAEWriteFilter::Filter(size_t dev_addr, const void* host_addr,
+                             size_t size,
+                             vector<pair<size_t, size_t> >& ranges) {
+  size_t end = dev_addr + size;
+  size_t first = (dev_addr + chunk_size_ - 1) / chunk_size_ * chunk_size_;
+  size_t last = end / chunk_size_ * chunk_size_;
+  if (first >= last) {
+    Invalidate(dev_addr, size);
+    ranges.push_back(make_pair((size_t)0, size));
+    return;
+  }
+
+  // Hashing is done outside the lock
+  vector<uint64_t> hashes;
+  hashes.reserve((last - first) / chunk_size_);
+  struct timespec begin_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &begin_time);
+  for (size_t chunk = first; chunk < last; chunk += chunk_size_)
+    hashes.push_back(Hash((const char*)host_addr + (chunk - dev_addr),
+                          chunk_size_));
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  pthread_mutex_lock(&mutex_);
+  hashed_bytes_ += last - first;
+  hash_time_ += (end_time.tv_sec - begin_time.tv_sec) * 1000000000ULL +
+                end_time.tv_nsec - begin_time.tv_nsec;
+  // Partially written chunks are transferred and forgotten
+  if (dev_addr < first)
+    InvalidateLocked(dev_addr, first - dev_addr);
+  if (last < end)
+    InvalidateLocked(last, end - last);
+
+  bool in_run = (dev_addr < first);
+  size_t run_begin = 0;
+  size_t index = 0;
+  for (size_t chunk = first; chunk < last; chunk += chunk_size_, index++) {
+    map<size_t, uint64_t>::iterator it = hashes_.find(chunk);
+    if (it != hashes_.end() && it->second == hashes[index]) {
+      if (in_run)
+        ranges.push_back(make_pair(run_begin, chunk - dev_addr - run_begin));
+      in_run = false;
+      elided_bytes_ += chunk_size_;
+    } else {
+      hashes_[chunk] = hashes[index];
+      if (!in_run)
+        run_begin = chunk - dev_addr;
+      in_run = true;
+    }
+  }
+  if (!in_run && last < end) {
+    run_begin = last - dev_addr;
+    in_run = true;
+  }
+  if (in_run)
+    ranges.push_back(make_pair(run_begin, size - run_begin));
+  pthread_mutex_unlock(&mutex_);
+}
+
+void OPAEWriteFilter::Invalidate(size_t dev_addr, size_t size) {
+  pthread_mutex_lock(&mutex_);
+  InvalidateLocked(dev_addr, size);
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Forgets every chunk that overlaps the given range
+void OPAEWriteFilter::InvalidateLocked(size_t dev_addr, size_t size) {
+  if (size == 0 || hashes_.empty())
+    return;
+  size_t first = dev_addr / chunk_size_ * chunk_size_;
+  hashes_.erase(hashes_.lower_bound(first),
+                hashes_.lower_bound(dev_addr + size));
+}
+
+// 64-bit xxHash
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t XXHRotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t XXHRead64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t XXHRead32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t XXHRound(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc = XXHRotl(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t XXHMergeRound(uint64_t acc, uint64_t val) {
+  acc ^= XXHRound(0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t OPAEWriteFilter::Hash(const void* data, size_t size) {
+  const unsigned char* p = (const unsigned char*)data;
+  const unsigned char* end = p + size;
+  uint64_t h;
+
+  if (size >= 32) {
+    uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = XXH_PRIME64_2;
+    uint64_t v3 = 0;
+    uint64_t v4 = 0 - XXH_PRIME64_1;
+    const unsigned char* limit = end - 32;
+    do {
+      v1 = XXHRound(v1, XXHRead64(p));
+      v2 = XXHRound(v2, XXHRead64(p + 8));
+      v3 = XXHRound(v3, XXHRead64(p + 16));
+      v4 = XXHRound(v4, XXHRead64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = XXHRotl(v1, 1) + XXHRotl(v2, 7) + XXHRotl(v3, 12) + XXHRotl(v4, 18);
+    h = XXHMergeRound(h, v1);
+    h = XXHMergeRound(h, v2);
+    h = XXHMergeRound(h, v3);
+    h = XXHMergeRound(h, v4);
+  } else {
+    h = XXH_PRIME64_5;
+  }
+  h += (uint64_t)size;
+
+  while (p + 8 <= end) {
+    h ^= XXHRound(0, XXHRead64(p));
+    h = XXHRotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)XXHRead32(p) * XXH_PRIME64_1;
+    h = XXHRotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= (*p) * XXH_PRIME64_5;
+    h = XXHRotl(h, 11) * XXH_PRIME64_1;
+    p++;
+  }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
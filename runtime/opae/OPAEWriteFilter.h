@@ -0,0 +1,82 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+
+#ifndef __SNUCL__OPAE_WRITE_FILTER_H
+#define __SNUCL__OPAE_WRITE_FILTER_H
+
+#include <map>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <CL/cl.h>
+
+// Remembers the hash of the last upload to each chunk of device memory so
+// that uploading the same contents again can be skipped. A chunk loses its
+// hash when anything other than a whole-chunk upload may change it.
+class OPAEWriteFilter {
+ public:
+  OPAEWriteFilter(size_t chunk_size);
+  ~OPAEWriteFilter();
+
+  // Returns the (offset, size) ranges of the write that must be transferred
+  void Filter(size_t dev_addr, const void* host_addr, size_t size,
+              std::vector<std::pair<size_t, size_t> >& ranges);
+  void Invalidate(size_t dev_addr, size_t size);
+
+  cl_ulong elided_bytes() const { return elided_bytes_; }
+  cl_ulong hashed_bytes() const { return hashed_bytes_; }
+  cl_ulong hash_time() const { return hash_time_; }
+
+ private:
+  void InvalidateLocked(size_t dev_addr, size_t size);
+  static uint64_t Hash(const void* data, size_t size);
+
+  size_t chunk_size_;
+  std::map<size_t, uint64_t> hashes_; // chunk address -> hash
+  cl_ulong elided_bytes_;
+  cl_ulong hashed_bytes_;
+  cl_ulong hash_time_; // in nanoseconds
+  pthread_mutex_t mutex_;
+};
+
+#endif // __SNUCL__OPAE_WRITE_FILTER_H
@@ -0,0 +1,290 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+// Times the coherence checks that a kernel launch makes for every buffer
+// argument on real CLMem objects: HasDevSpecific, HasLatest, and
+// GetDevSpecific. Buffers whose latest state is one range take the lock-free
+// path, and buffers split into ranges take mutex_dev_latest_. The runtime no
+// longer has the lookups that came before device indices, so MapMem models
+// them as a baseline: a mutex with a std::map of handles and a std::set of
+// latest devices per range.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <CL/cl.h>
+#include "CLContext.h"
+#include "CLDevice.h"
+#include "CLMem.h"
+#include "CLPlatform.h"
+
+#define NUM_DEVICES 4
+#define NUM_LAUNCHES 200000
+#define MAX_THREADS 4
+#define BUFFER_SIZE 4096
+
+using namespace std;
+
+// Hands out fake device addresses and runs nothing
+class BenchDevice: public CLDevice {
+ public:
+  BenchDevice() : CLDevice(0) {}
+
+  virtual void LaunchKernel(CLCommand* command, CLKernel* kernel,
+                            cl_uint work_dim, size_t gwo[3], size_t gws[3],
+                            size_t lws[3], size_t nwg[3],
+                            map<cl_uint, CLKernelArg*>* kernel_args) {}
+  virtual void LaunchNativeKernel(CLCommand* command, void (*user_func)(void*),
+                                  void* native_args, size_t size,
+                                  cl_uint num_mem_objects, CLMem** mem_list,
+                                  ptrdiff_t* mem_offsets) {}
+  virtual void ReadBuffer(CLCommand* command, CLMem* mem_src, size_t off_src,
+                          size_t size, void* ptr) {}
+  virtual void WriteBuffer(CLCommand* command, CLMem* mem_dst, size_t off_dst,
+                           size_t size, void* ptr) {}
+  virtual void CopyBuffer(CLCommand* command, CLMem* mem_src, CLMem* mem_dst,
+                          size_t off_src, size_t off_dst, size_t size) {}
+  virtual void ReadImage(CLCommand* command, CLMem* mem_src,
+                         size_t src_origin[3], size_t region[3],
+                         size_t dst_row_pitch, size_t dst_slice_pitch,
+                         void* ptr) {}
+  virtual void WriteImage(CLCommand* command, CLMem* mem_dst,
+                          size_t dst_origin[3], size_t region[3],
+                          size_t src_row_pitch, size_t src_slice_pitch,
+                          void* ptr) {}
+  virtual void CopyImage(CLCommand* command, CLMem* mem_src, CLMem* mem_dst,
+                         size_t src_origin[3], size_t dst_origin[3],
+                         size_t region[3]) {}
+  virtual void CopyImageToBuffer(CLCommand* command, CLMem* mem_src,
+                                 CLMem* mem_dst, size_t src_origin[3],
+                                 size_t region[3], size_t off_dst) {}
+  virtual void CopyBufferToImage(CLCommand* command, CLMem* mem_src,
+                                 CLMem* mem_dst, size_t off_src,
+                                 size_t dst_origin[3], size_t region[3]) {}
+  virtual void ReadBufferRect(CLCommand* command, CLMem* mem_src,
+                              size_t src_origin[3], size_t dst_origin[3],
+                              size_t region[3], size_t src_row_pitch,
+                              size_t src_slice_pitch, size_t dst_row_pitch,
+                              size_t dst_slice_pitch, void* ptr) {}
+  virtual void WriteBufferRect(CLCommand* command, CLMem* mem_dst,
+                               size_t src_origin[3], size_t dst_origin[3],
+                               size_t region[3], size_t src_row_pitch,
+                               size_t src_slice_pitch, size_t dst_row_pitch,
+                               size_t dst_slice_pitch, void* ptr) {}
+  virtual void CopyBufferRect(CLCommand* command, CLMem* mem_src,
+                              CLMem* mem_dst, size_t src_origin[3],
+                              size_t dst_origin[3], size_t region[3],
+                              size_t src_row_pitch, size_t src_slice_pitch,
+                              size_t dst_row_pitch, size_t dst_slice_pitch) {}
+  virtual void FillBuffer(CLCommand* command, CLMem* mem_dst, void* pattern,
+                          size_t pattern_size, size_t off_dst, size_t size) {}
+  virtual void FillImage(CLCommand* command, CLMem* mem_dst, void* fill_color,
+                         size_t dst_origin[3], size_t region[3]) {}
+  virtual void BuildProgram(CLCommand* command, CLProgram* program,
+                            CLProgramSource* source, CLProgramBinary* binary,
+                            const char* options) {}
+  virtual void CompileProgram(CLCommand* command, CLProgram* program,
+                              CLProgramSource* source, const char* options,
+                              size_t num_headers, CLProgramSource** headers) {}
+  virtual void LinkProgram(CLCommand* command, CLProgram* program,
+                           size_t num_binaries, CLProgramBinary** binaries,
+                           const char* options) {}
+
+  virtual void* AllocMem(CLMem* mem) {
+    return (void*)(size_t)(0x1000 * (index() + 1));
+  }
+  virtual void FreeMem(CLMem* mem, void* dev_specific) {}
+  virtual void FreeExecutable(CLProgram* program, void* executable) {}
+};
+
+static CLDevice* devices[NUM_DEVICES];
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Handles keyed by device, and a set of latest devices per range
+class MapMem {
+ public:
+  MapMem() {
+    pthread_mutex_init(&mutex_dev_specific_, NULL);
+    pthread_mutex_init(&mutex_dev_latest_, NULL);
+    for (int i = 0; i < NUM_DEVICES; i++)
+      dev_specific_[devices[i]] = (void*)(size_t)(0x1000 * (i + 1));
+    latest_[0].insert(devices[0]);
+    latest_[0].insert(devices[NUM_DEVICES - 1]);
+  }
+
+  bool HasDevSpecific(CLDevice* device) {
+    pthread_mutex_lock(&mutex_dev_specific_);
+    bool alloc = (dev_specific_.count(device) > 0);
+    pthread_mutex_unlock(&mutex_dev_specific_);
+    return alloc;
+  }
+
+  void* GetDevSpecific(CLDevice* device) {
+    pthread_mutex_lock(&mutex_dev_specific_);
+    void* dev_specific = dev_specific_[device];
+    pthread_mutex_unlock(&mutex_dev_specific_);
+    return dev_specific;
+  }
+
+  bool HasLatest(CLDevice* device, size_t offset, size_t size) {
+    pthread_mutex_lock(&mutex_dev_latest_);
+    map<size_t, set<CLDevice*> >::iterator it = latest_.upper_bound(offset);
+    --it;
+    bool latest = (it->second.count(device) > 0);
+    pthread_mutex_unlock(&mutex_dev_latest_);
+    return latest;
+  }
+
+ private:
+  map<CLDevice*, void*> dev_specific_;
+  map<size_t, set<CLDevice*> > latest_; // range offset -> devices
+  pthread_mutex_t mutex_dev_specific_;
+  pthread_mutex_t mutex_dev_latest_;
+};
+
+template <typename Mem>
+struct BenchArgs {
+  vector<Mem*>* mems;
+  size_t sum;
+};
+
+// What the scheduler and SetKernelParam ask about every buffer argument
+template <typename Mem>
+static void* LaunchFunc(void* argp) {
+  BenchArgs<Mem>* args = (BenchArgs<Mem>*)argp;
+  vector<Mem*>& mems = *args->mems;
+  size_t sum = 0;
+  for (int launch = 0; launch < NUM_LAUNCHES; launch++) {
+    CLDevice* device = devices[launch % NUM_DEVICES];
+    for (size_t i = 0; i < mems.size(); i++) {
+      if (mems[i]->HasDevSpecific(device) &&
+          !mems[i]->HasLatest(device, 0, BUFFER_SIZE))
+        sum++;
+      sum += (size_t)mems[i]->GetDevSpecific(device);
+    }
+  }
+  args->sum = sum;
+  return NULL;
+}
+
+// Returns nanoseconds per launch
+template <typename Mem>
+static double Run(vector<Mem*>& mems, int num_threads) {
+  pthread_t threads[MAX_THREADS];
+  BenchArgs<Mem> args[MAX_THREADS];
+  double start = Now();
+  for (int t = 0; t < num_threads; t++) {
+    args[t].mems = &mems;
+    pthread_create(&threads[t], NULL, LaunchFunc<Mem>, &args[t]);
+  }
+  for (int t = 0; t < num_threads; t++)
+    pthread_join(threads[t], NULL);
+  return (Now() - start) * 1e9 / NUM_LAUNCHES;
+}
+
+// Places the buffer on every device, with the latest contents on the first
+// and the last device. A segmented buffer has its first line newer on the
+// last device only.
+static CLMem* CreateMem(CLContext* context, bool segmented) {
+  cl_int err = CL_SUCCESS;
+  CLMem* mem = CLMem::CreateBuffer(context, CL_MEM_READ_WRITE, BUFFER_SIZE,
+                                   NULL, &err);
+  if (err != CL_SUCCESS) {
+    fprintf(stderr, "Cannot create a buffer (%d)\n", err);
+    exit(1);
+  }
+  for (int i = 0; i < NUM_DEVICES; i++)
+    mem->GetDevSpecific(devices[i]);
+  mem->SetLatest(devices[0]);
+  mem->AddLatest(devices[NUM_DEVICES - 1], 0, BUFFER_SIZE);
+  if (segmented)
+    mem->SetLatest(devices[NUM_DEVICES - 1], 0, 64);
+  return mem;
+}
+
+int main(int argc, char** argv) {
+  CLPlatform::GetPlatform();
+  vector<CLDevice*> context_devices;
+  for (int i = 0; i < NUM_DEVICES; i++) {
+    devices[i] = new BenchDevice();
+    context_devices.push_back(devices[i]);
+  }
+  CLContext* context = new CLContext(context_devices, 0, NULL);
+
+  size_t num_args[] = {4, 16, 64};
+  int num_threads[] = {1, MAX_THREADS};
+  printf("%6s %8s %12s %12s %8s %12s %8s\n", "args", "threads",
+         "model (ns)", "CLMem (ns)", "speedup", "split (ns)", "speedup");
+  for (size_t a = 0; a < sizeof(num_args) / sizeof(num_args[0]); a++) {
+    vector<MapMem*> map_mems;
+    vector<CLMem*> mems;
+    vector<CLMem*> split_mems;
+    for (size_t i = 0; i < num_args[a]; i++) {
+      map_mems.push_back(new MapMem());
+      mems.push_back(CreateMem(context, false));
+      split_mems.push_back(CreateMem(context, true));
+    }
+    for (size_t t = 0; t < sizeof(num_threads) / sizeof(num_threads[0]);
+         t++) {
+      double map_time = Run(map_mems, num_threads[t]);
+      double mem_time = Run(mems, num_threads[t]);
+      double split_time = Run(split_mems, num_threads[t]);
+      printf("%6zu %8d %12.1f %12.1f %7.1fx %12.1f %7.1fx\n", num_args[a],
+             num_threads[t], map_time, mem_time, map_time / mem_time,
+             split_time, map_time / split_time);
+    }
+    for (size_t i = 0; i < num_args[a]; i++) {
+      delete map_mems[i];
+      mems[i]->Release();
+      split_mems[i]->Release();
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,290 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+// Exercises CLDirtyTracker on plain host memory. Tracking is enabled by an
+// environment variable read when the tracker is created, so the disabled
+// case runs in a child process.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "CLDirtyTracker.h"
+#include "CLMemcpyPool.h"
+
+#define NUM_PAGES 130
+
+#define CHECK(cond, ...) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      exit(1); \
+    } \
+  } while (false)
+
+using namespace std;
+
+typedef vector<pair<size_t, size_t> > RangeList;
+
+static size_t page_size;
+
+static char* AllocPages(size_t num_pages) {
+  void* ptr = mmap(NULL, num_pages * page_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(ptr != MAP_FAILED, "cannot map %zu pages", num_pages);
+  return (char*)ptr;
+}
+
+static void Touch(char* base, size_t page) {
+  base[page * page_size + 17] = (char)(page + 1);
+}
+
+// Compares the collected ranges with (first page, number of pages) pairs
+static void ExpectRanges(const RangeList& ranges, const size_t* expected,
+                         size_t num_expected, const char* what) {
+  CHECK(ranges.size() == num_expected, "%s: %zu ranges instead of %zu",
+        what, ranges.size(), num_expected);
+  for (size_t i = 0; i < num_expected; i++) {
+    CHECK(ranges[i].first == expected[2 * i] * page_size &&
+          ranges[i].second == expected[2 * i + 1] * page_size,
+          "%s: range %zu is (0x%zX, 0x%zX)", what, i, ranges[i].first,
+          ranges[i].second);
+  }
+}
+
+static void* RuntimeThreadFunc(void* argp) {
+  char* base = (char*)argp;
+  CLDirtyTracker::EnterRuntimeThread();
+  Touch(base, 1);
+  Touch(base, 2);
+  CLDirtyTracker::ReprotectRuntimePages();
+  return NULL;
+}
+
+static void TestCapture(CLDirtyTracker* tracker) {
+  char* base = AllocPages(NUM_PAGES);
+  int slot = tracker->Register(base, NUM_PAGES * page_size);
+  CHECK(slot != -1, "cannot track %d pages", NUM_PAGES);
+
+  RangeList ranges;
+  tracker->CollectDirtyPages(slot, ranges);
+  ExpectRanges(ranges, NULL, 0, "untouched");
+
+  // Reads do not mark pages
+  volatile char sum = 0;
+  for (size_t page = 0; page < NUM_PAGES; page++)
+    sum += base[page * page_size];
+
+  Touch(base, 2);
+  Touch(base, 9);
+  Touch(base, 9);
+  CHECK(base[9 * page_size + 17] == 10, "write to a tracked page was lost");
+  ranges.clear();
+  tracker->CollectDirtyPages(slot, ranges);
+  size_t capture[] = {2, 1, 9, 1};
+  ExpectRanges(ranges, capture, 2, "capture");
+
+  // Adjacent pages form one range, also across words of the bitmap
+  Touch(base, 3);
+  Touch(base, 5);
+  Touch(base, 4);
+  Touch(base, 7);
+  Touch(base, 63);
+  Touch(base, 64);
+  Touch(base, 65);
+  Touch(base, NUM_PAGES - 1);
+  ranges.clear();
+  tracker->CollectDirtyPages(slot, ranges);
+  size_t coalesce[] = {3, 3, 7, 1, 63, 3, NUM_PAGES - 1, 1};
+  ExpectRanges(ranges, coalesce, 4, "coalesce");
+
+  // Collected pages are protected again, so the next write traps again
+  ranges.clear();
+  tracker->CollectDirtyPages(slot, ranges);
+  ExpectRanges(ranges, NULL, 0, "after collect");
+  Touch(base, 3);
+  ranges.clear();
+  tracker->CollectDirtyPages(slot, ranges);
+  size_t reprotect[] = {3, 1};
+  ExpectRanges(ranges, reprotect, 1, "reprotect");
+
+  // Collecting appends to the ranges already in the list
+  Touch(base, 20);
+  tracker->CollectDirtyPages(slot, ranges);
+  size_t append[] = {3, 1, 20, 1};
+  ExpectRanges(ranges, append, 2, "append");
+
+  // Writes of runtime threads are not the application's
+  pthread_t thread;
+  pthread_create(&thread, NULL, RuntimeThreadFunc, base);
+  pthread_join(thread, NULL);
+  ranges.clear();
+  tracker->CollectDirtyPages(slot, ranges);
+  ExpectRanges(ranges, NULL, 0, "runtime thread");
+  Touch(base, 1);
+  tracker->CollectDirtyPages(slot, ranges);
+  size_t after_runtime[] = {1, 1};
+  ExpectRanges(ranges, after_runtime, 1, "after runtime thread");
+
+  // Overlapping host memory cannot be tracked twice
+  CHECK(tracker->Register(base + page_size, page_size) == -1,
+        "overlapping range was tracked");
+
+  tracker->Unregister(slot);
+  Touch(base, 30);
+  munmap(base, NUM_PAGES * page_size);
+}
+
+// Slots of unregistered ranges are reused, with clean bitmaps
+static void TestReuse(CLDirtyTracker* tracker) {
+  char* first = AllocPages(4);
+  int slot = tracker->Register(first, 4 * page_size);
+  CHECK(slot != -1, "cannot track 4 pages");
+  Touch(first, 1);
+  tracker->Unregister(slot);
+
+  char* second = AllocPages(2);
+  int reused = tracker->Register(second, 2 * page_size);
+  CHECK(reused == slot, "slot %d was not reused (got %d)", slot, reused);
+  RangeList ranges;
+  tracker->CollectDirtyPages(reused, ranges);
+  ExpectRanges(ranges, NULL, 0, "reused slot");
+  Touch(second, 0);
+  tracker->CollectDirtyPages(reused, ranges);
+  size_t expected[] = {0, 1};
+  ExpectRanges(ranges, expected, 1, "reused slot");
+  tracker->Unregister(reused);
+  munmap(first, 4 * page_size);
+  munmap(second, 2 * page_size);
+}
+
+struct PoolCopyArgs {
+  char* dst;
+  char* src;
+  size_t size;
+};
+
+static void* PoolCopyFunc(void* argp) {
+  PoolCopyArgs* args = (PoolCopyArgs*)argp;
+  CLDirtyTracker::EnterRuntimeThread();
+  CLMemcpyPool::GetPool()->Copy(args->dst, args->src, args->size);
+  CLDirtyTracker::ReprotectRuntimePages();
+  return NULL;
+}
+
+// A runtime thread that splits a download across the copy workers does not
+// dirty the pages, and the pages trap again once the copy returns
+static void TestPoolCopy(CLDirtyTracker* tracker) {
+  size_t num_pages = 1024;
+  char* base = AllocPages(num_pages);
+  char* src = AllocPages(num_pages);
+  memset(src, 7, num_pages * page_size);
+  int slot = tracker->Register(base, num_pages * page_size);
+  CHECK(slot != -1, "cannot track %zu pages", num_pages);
+
+  PoolCopyArgs args = {base, src, num_pages * page_size};
+  pthread_t thread;
+  pthread_create(&thread, NULL, PoolCopyFunc, &args);
+  pthread_join(thread, NULL);
+  CHECK(memcmp(base, src, num_pages * page_size) == 0, "copy was lost");
+  RangeList ranges;
+  tracker->CollectDirtyPages(slot, ranges);
+  ExpectRanges(ranges, NULL, 0, "pool copy");
+
+  for (size_t page = 0; page < num_pages; page += 8)
+    Touch(base, page);
+  tracker->CollectDirtyPages(slot, ranges);
+  CHECK(ranges.size() == num_pages / 8,
+        "pool copy: %zu pages trapped after the copy instead of %zu",
+        ranges.size(), num_pages / 8);
+
+  tracker->Unregister(slot);
+  munmap(base, num_pages * page_size);
+  munmap(src, num_pages * page_size);
+}
+
+// Without tracking, nothing is registered and the memory stays writable, so
+// callers upload whole buffers
+static int TestDisabled() {
+  unsetenv("SNUCL_DIRTY_TRACKING");
+  CLDirtyTracker* tracker = CLDirtyTracker::GetTracker();
+  CHECK(!tracker->enabled(), "tracking is enabled without the variable");
+  char* base = AllocPages(4);
+  CHECK(tracker->Register(base, 4 * page_size) == -1,
+        "range was tracked while tracking is disabled");
+  Touch(base, 2);
+  munmap(base, 4 * page_size);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  page_size = sysconf(_SC_PAGESIZE);
+
+  pid_t pid = fork();
+  CHECK(pid != -1, "cannot fork");
+  if (pid == 0)
+    exit(TestDisabled());
+  int status;
+  waitpid(pid, &status, 0);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        "disabled tracker failed");
+
+  setenv("SNUCL_DIRTY_TRACKING", "1", 1);
+  CLDirtyTracker* tracker = CLDirtyTracker::GetTracker();
+  CHECK(tracker->enabled(), "tracking is not enabled");
+  CHECK(tracker->Register(NULL, 0) == -1, "empty range was tracked");
+  TestCapture(tracker);
+  TestReuse(tracker);
+
+  // Every copy of a page or more goes to the workers
+  setenv("SNUCL_MEMCPY_THRESHOLD", "4096", 1);
+  setenv("SNUCL_MEMCPY_THREADS", "4", 1);
+  TestPoolCopy(tracker);
+
+  printf("CLDirtyTrackerTest passed\n");
+  return 0;
+}
@@ -0,0 +1,161 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+// Measures staged transfers against a DMA engine that takes as long as a
+// PCIe link of a given bandwidth. The copies between the staging buffer and
+// user memory must overlap the DMA, so a transfer has to take clearly less
+// than the DMA time plus the copy time.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <malloc.h>
+#include <stdint.h>
+#include <time.h>
+#include "CLMemcpyPool.h"
+#include "opae/OPAEDMAEngine.h"
+#include "opae/OPAETransfer.h"
+
+#define TRANSFER_SIZE (128 * 1024 * 1024)
+#define STAGING_SIZE (32 * 1024 * 1024)
+#define STAGING_IO_ADDR 0x100000000UL
+#define NUM_RUNS 3
+// Fraction of the copy time that the transfers must hide
+#define MIN_HIDDEN 0.5
+
+using namespace std;
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Completes transfers one after another at a fixed bandwidth without moving
+// any data, so the host spends no time on them
+class TimedDMAEngine: public OPAEDMAEngine {
+ public:
+  TimedDMAEngine(double bandwidth, size_t max_outstanding)
+      : OPAEDMAEngine(max_outstanding) {
+    bandwidth_ = bandwidth;
+    last_end_ = 0.0;
+  }
+
+ protected:
+  virtual void Issue(const OPAEDMADescriptor& desc) {
+    double start = max(Now(), last_end_);
+    last_end_ = start + desc.num_lines * LINE_SIZE / bandwidth_;
+    ends_.push_back(last_end_);
+  }
+
+  virtual size_t Retire() {
+    double now = Now();
+    size_t retired = 0;
+    while (!ends_.empty() && ends_.front() <= now) {
+      ends_.pop_front();
+      retired++;
+    }
+    return retired;
+  }
+
+ private:
+  double bandwidth_; // in bytes per second
+  double last_end_;
+  deque<double> ends_;
+};
+
+static double TimeCopy(char* dst, char* src, bool non_temporal) {
+  double best = 1e9;
+  for (int run = 0; run < NUM_RUNS; run++) {
+    double start = Now();
+    for (size_t offset = 0; offset < TRANSFER_SIZE; offset += STAGING_SIZE)
+      CLMemcpyPool::GetPool()->Copy(dst, src + offset, STAGING_SIZE,
+                                    non_temporal);
+    best = min(best, Now() - start);
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  char* staging = (char*)memalign(4096, STAGING_SIZE);
+  char* user = (char*)memalign(4096, TRANSFER_SIZE);
+  memset(staging, 1, STAGING_SIZE);
+  memset(user, 2, TRANSFER_SIZE);
+
+  // The link runs as fast as the host copies, which is where overlapping
+  // the two gains the most
+  double copy_time = TimeCopy(staging, user, true);
+  double bandwidth = TRANSFER_SIZE / copy_time;
+  TimedDMAEngine engine(bandwidth, 8);
+  OPAETransfer transfer(&engine, staging, STAGING_IO_ADDR, STAGING_SIZE);
+  double dma_time = TRANSFER_SIZE / bandwidth;
+
+  bool passed = true;
+  for (int write = 0; write <= 1; write++) {
+    double best = 1e9;
+    for (int run = 0; run < NUM_RUNS; run++) {
+      double start = Now();
+      if (write)
+        transfer.Write(0, user, TRANSFER_SIZE);
+      else
+        transfer.Read(0, user, TRANSFER_SIZE);
+      best = min(best, Now() - start);
+    }
+    double serial = dma_time + copy_time;
+    printf("%s: %.0f MB/s (DMA %.0f MB/s, serial %.0f MB/s)\n",
+           (write ? "write" : "read"), TRANSFER_SIZE / best / 1e6,
+           bandwidth / 1e6, TRANSFER_SIZE / serial / 1e6);
+    if (best > dma_time + copy_time * (1.0 - MIN_HIDDEN)) {
+      fprintf(stderr, "FAIL %s: %.1f ms, DMA alone takes %.1f ms and the "
+              "copies %.1f ms\n", (write ? "write" : "read"), best * 1e3,
+              dma_time * 1e3, copy_time * 1e3);
+      passed = false;
+    }
+  }
+
+  free(user);
+  free(staging);
+  if (!passed)
+    return 1;
+  printf("OPAETransferBandwidthTest passed\n");
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*****************************************************************************/
+/*                                                                           */
+/* Copyright (c) 2020 Seoul National University.                             */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* Redistribution and use in source and binary forms, with or without        */
+/* modification, are permitted provided that the following conditions        */
+/* are met:                                                                  */
+/*   1. Redistributions of source code must retain the above copyright       */
+/*      notice, this list of conditions and the following disclaimer.        */
+/*   2. Redistributions in binary form must reproduce the above copyright    */
+/*      notice, this list of conditions and the following disclaimer in the  */
+/*      documentation and/or other materials provided with the distribution. */
+/*   3. Neither the name of Seoul National University nor the names of its   */
+/*      contributors may be used to endorse or promote products derived      */
+/*      from this software without specific prior written permission.        */
+/*                                                                           */
+/* THIS SOFTWARE IS PROVIDED BY SEOUL NATIONAL UNIVERSITY "AS IS" AND ANY    */
+/* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED */
+/* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE    */
+/* DISCLAIMED. IN NO EVENT SHALL SEOUL NATIONAL UNIVERSITY BE LIABLE FOR ANY */
+/* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL        */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS   */
+/* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)     */
+/* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,       */
+/* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN  */
+/* ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE           */
+/* POSSIBILITY OF SUCH DAMAGE.                                               */
+/*                                                                           */
+/* Contact information:                                                      */
+/*   Center for Manycore Programming                                         */
+/*   Department of Computer Science and Engineering                          */
+/*   Seoul National University, Seoul 08826, Korea                           */
+/*   http://aces.snu.ac.kr                                                   */
+/*                                                                           */
+/* Contributors:                                                             */
+/*   Gangwon Jo, Heehoon Kim, Jeesoo Lee, and Jaejin Lee                     */
+/*                                                                           */
+/*****************************************************************************/
+
+// Drives OPAETransfer against the software DMA engine and checks device
+// memory against a host copy after every transfer
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <stdint.h>
+#include "opae/OPAEDMAEngine.h"
+#include "opae/OPAELineCache.h"
+#include "opae/OPAETransfer.h"
+
+#define DEV_SIZE (64 * 1024)
+// Four slots of four lines, so that most cases take several chunks
+#define STAGING_SIZE (16 * 64)
+#define STAGING_IO_ADDR 0x100000000UL
+#define PINNED_IO_ADDR 0x200000000UL
+#define GUARD 64
+
+#define CHECK(cond, ...) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+      exit(1); \
+    } \
+  } while (false)
+
+struct TransferCase {
+  size_t dev_addr;
+  size_t size;
+};
+
+static const TransferCase cases[] = {
+  {0, 64},            // one aligned line
+  {128, 4096},        // aligned, larger than the staging buffer
+  {3, 100},           // unaligned head
+  {64, 70},           // unaligned tail
+  {5, 10},            // inside one line
+  {60, 8},            // across two lines
+  {13, 5000},         // unaligned at both ends, several chunks
+  {1000, 1024 - 40},  // exactly one staging buffer of lines
+  {7, 16 * 1024 + 3}, // many chunks
+};
+static const size_t num_cases = sizeof(cases) / sizeof(cases[0]);
+
+static char ref[DEV_SIZE];
+
+static void Fill(char* ptr, size_t size, unsigned seed) {
+  for (size_t i = 0; i < size; i++)
+    ptr[i] = (char)(rand_r(&seed) & 0xFF);
+}
+
+static void CheckDevice(OPAESoftDMAEngine* engine, const char* what,
+                        size_t c) {
+  CHECK(memcmp(engine->mem(), ref, DEV_SIZE) == 0,
+        "%s: device memory differs after case %zu", what, c);
+}
+
+static void RunCases(size_t depth, bool use_line_cache, bool pinned) {
+  const char* what = (pinned ? "pinned" : "staged");
+  OPAESoftDMAEngine engine(DEV_SIZE, depth);
+  char* staging = (char*)memalign(4096, STAGING_SIZE);
+  engine.MapHost(STAGING_IO_ADDR, staging, STAGING_SIZE);
+  OPAELineCache* line_cache =
+      (use_line_cache ? new OPAELineCache(16) : NULL);
+  OPAETransfer transfer(&engine, staging, STAGING_IO_ADDR, STAGING_SIZE,
+                        line_cache);
+
+  // Pinned user memory starts at the same offset within a line as the
+  // device address
+  size_t user_size = DEV_SIZE + 2 * GUARD;
+  char* user = (char*)memalign(4096, user_size);
+  engine.MapHost(PINNED_IO_ADDR, user, user_size);
+  char* expected = (char*)malloc(user_size);
+
+  Fill(ref, DEV_SIZE, 1);
+  memcpy(engine.mem(), ref, DEV_SIZE);
+
+  for (size_t c = 0; c < num_cases; c++) {
+    size_t dev_addr = cases[c].dev_addr;
+    size_t size = cases[c].size;
+    size_t offset = GUARD + dev_addr % OPAETransfer::LINE_SIZE;
+    char* ptr = user + offset;
+
+    Fill(ptr, size, (unsigned)(c + 2));
+    memcpy(ref + dev_addr, ptr, size);
+    if (pinned)
+      transfer.WritePinned(dev_addr, ptr, PINNED_IO_ADDR + offset, size);
+    else
+      transfer.Write(dev_addr, ptr, size);
+    CheckDevice(&engine, what, c);
+
+    // The device changes behind the line cache only through transfers, so
+    // a read back must not see stale lines
+    Fill(user, user_size, 0);
+    memcpy(expected, user, user_size);
+    memcpy(expected + offset, ref + dev_addr, size);
+    if (pinned)
+      transfer.ReadPinned(dev_addr, ptr, PINNED_IO_ADDR + offset, size);
+    else
+      transfer.Read(dev_addr, ptr, size);
+    CHECK(memcmp(user, expected, user_size) == 0,
+          "%s: read of case %zu differs", what, c);
+  }
+
+  // Unaligned writes next to each other reuse the lines they share
+  for (size_t addr = 3; addr + 50 < 2048; addr += 50) {
+    Fill(ref + addr, 50, (unsigned)addr);
+    transfer.Write(addr, ref + addr, 50);
+  }
+  CheckDevice(&engine, what, num_cases);
+  if (line_cache != NULL)
+    CHECK(line_cache->hits() > 0, "%s: line cache never hit", what);
+
+  free(expected);
+  free(user);
+  free(staging);
+  delete line_cache;
+}
+
+int main(int argc, char** argv) {
+  size_t depths[] = {1, 2, 8};
+  for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+    for (int line_cache = 0; line_cache <= 1; line_cache++) {
+      RunCases(depths[i], line_cache != 0, false);
+      RunCases(depths[i], line_cache != 0, true);
+    }
+  }
+  printf("OPAETransferTest passed\n");
+  return 0;
+}